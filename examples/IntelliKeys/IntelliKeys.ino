@@ -7,6 +7,9 @@
 
 #include <USBHost_t36.h>
 #include <intellikeys.h>
+#include <ik_contacts.h>
+#include <ik_pointer.h>
+#include <ik_gesture.h>
 #include <keymouse_play.h>  // https://github.com/gdsports/keymouse_t3
 #include "keymouse.h"
 
@@ -19,16 +22,62 @@ keymouse_play keyplay;
 elapsedMillis beepTime;
 bool Connected = false;
 
+// Switch 2 toggles touch screen mode. The whole membrane then maps to the
+// screen and a touch moves the mouse pointer straight to that spot. Two
+// fingers moving up or down scroll, pinching zooms.
+#define SCREEN_WIDTH  1920
+#define SCREEN_HEIGHT 1080
+IKContactTracker contacts;
+IKPointer pointer;
+IKGestures gestures;
+bool TouchScreen = false;
+
+void IK_contact(const ik_contact_t &contact, int event)
+{
+  pointer.contact(contact, event);
+  gestures.contact(contact, event, millis());
+}
+
+void IK_scroll(int steps)
+{
+  Mouse.scroll(steps);
+}
+
+void IK_pinch(int steps)
+{
+  // Browser style zoom, CTRL+'=' to zoom in, CTRL+'-' to zoom out
+  uint16_t key = (steps > 0) ? KEY_EQUAL : KEY_MINUS;
+  for (int i = abs(steps); i > 0; i--) {
+    Keyboard.press(MODIFIERKEY_CTRL);
+    Keyboard.press(key);
+    Keyboard.release(key);
+    Keyboard.release(MODIFIERKEY_CTRL);
+  }
+}
+
+void IK_pointer(int x, int y)
+{
+  Mouse.moveTo(x, y);
+}
+
 void IK_press(int x, int y)
 {
   Serial.printf("membrane press (%d,%d)\n", x, y);
-  process_membrane_press(ikey1, x, y);
+  if (TouchScreen) {
+    contacts.press(x, y);
+  } else {
+    process_membrane_press(ikey1, x, y);
+  }
 }
 
 void IK_release(int x, int y)
 {
   Serial.printf("membrane release (%d,%d)\n", x, y);
-  process_membrane_release(ikey1, x, y);
+  if (TouchScreen) {
+    contacts.release(x, y);
+  } else {
+    process_membrane_release(ikey1, x, y);
+  }
 }
 
 const char keysequence[] =
@@ -43,6 +92,13 @@ void IK_switch(int switch_number, int switch_state)
       keyplay.start(keysequence);
       break;
     case 2:
+      TouchScreen = !TouchScreen;
+      Serial.printf("touch screen mode %d\n", TouchScreen);
+      clear_membrane();
+      contacts.reset();
+      pointer.reset();
+      gestures.reset();
+      ikey1.setLED(IntelliKeys::IK_LED_MOUSE, TouchScreen);
       break;
   }
 }
@@ -63,6 +119,11 @@ void IK_connect(void)
   Connected = true;
 }
 
+void IK_ready(void)
+{
+  Serial.printf("IK ready in %lu ms\n", ikey1.readyTime());
+}
+
 void IK_disconnect(void)
 {
   Serial.println("IK disconnect");
@@ -74,6 +135,9 @@ void IK_onoff(int onoff)
   Serial.printf("On/Off switch = %d\n", onoff);
   if (onoff == 0) {
     clear_membrane();
+    contacts.reset();
+    pointer.reset();
+    gestures.reset();
     ikey1.setLED(IntelliKeys::IK_LED_SHIFT, 0);
     ikey1.setLED(IntelliKeys::IK_LED_CAPS_LOCK, 0);
     ikey1.setLED(IntelliKeys::IK_LED_MOUSE, 0);
@@ -116,6 +180,7 @@ void setup() {
   ikey1.begin();
   ikey1.onConnect(IK_connect);
   ikey1.onDisconnect(IK_disconnect);
+  ikey1.onReady(IK_ready);
   ikey1.onMembranePress(IK_press);
   ikey1.onMembraneRelease(IK_release);
   ikey1.onSwitch(IK_switch);
@@ -123,14 +188,26 @@ void setup() {
   ikey1.onVersion(IK_version);
   ikey1.onOnOffSwitch(IK_onoff);
   ikey1.onSerialNum(IK_get_SN);
+  ikey1.setCalibrationCache(0);
   ikey1.onCorrectMembrane(IK_correct_membrane);
   ikey1.onCorrectSwitch(IK_correct_switch);
   ikey1.onCorrectDone(IK_correct_done);
+
+  keymouse_begin(ikey1);
+  Mouse.screenSize(SCREEN_WIDTH, SCREEN_HEIGHT);
+  pointer.setOutput(SCREEN_WIDTH, SCREEN_HEIGHT);
+  pointer.onMove(IK_pointer);
+  contacts.onContact(IK_contact);
+  gestures.onScroll(IK_scroll);
+  gestures.onPinch(IK_pinch);
 }
 
 void loop() {
   myusb.Task();
   keyplay.loop();
+  keymouse_task();
+  pointer.task(millis());
+  gestures.task(millis());
   if (Connected && beepTime > 30000) {
     //ikey1.sound(1000, 100, 500);
     beepTime = 0;
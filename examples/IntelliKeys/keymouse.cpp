@@ -6,17 +6,25 @@
 #include <Arduino.h>
 #include <USBHost_t36.h>
 #include <intellikeys.h>
+#include <ik_regionmap.h>
+#include <ik_chord.h>
+#include <ik_dwell.h>
 #include "keymouse.h"
 
 /*
  * The native touch resolution is 24x24. For this example, each virtual button
- * is 2 native columns by 3 rows. This array represents the 8 rows of 12
- * virtual buttons. The elements are incremented with each native touch press
- * and decremented with each native touch release. When the count goes from 0
- * to 1, press action (see membrane_actions[]) is performed. When the count
- * goes from 1 to 0, the release action is performed.
+ * is 2 native columns by 3 rows giving 8 rows of 12 virtual buttons. The
+ * region map counts the native touches on each virtual button. When the count
+ * goes from 0 to 1, press action (see membrane_actions[]) is performed. When
+ * the count goes from 1 to 0, the release action is performed.
  */
-static uint8_t membrane[8][12];
+static IKRegionMap keymap(12, 8);
+static IKChords chords;
+
+// Accept delay. A key acts only once it has been held this long, for users
+// who rest their hands on the overlay. 0 acts on touch.
+#define KEY_DWELL_MS	(0)
+static IKDwell dwell;
 
 static const uint16_t membrane_actions[8][12] = {
 	// Top row = 0
@@ -125,7 +133,9 @@ static const uint16_t membrane_actions[8][12] = {
 	0,
 };
 
+// 0 means no action so the first action must be 1.
 enum mouse_actions {
+	MOUSE_NONE,
 	MOUSE_MOVE_NW, MOUSE_MOVE_N, MOUSE_MOVE_NE,
 	MOUSE_MOVE_W,  MOUSE_CLICK,  MOUSE_MOVE_E,
 	MOUSE_MOVE_SW, MOUSE_MOVE_S, MOUSE_MOVE_SE,
@@ -240,6 +250,133 @@ static const uint16_t membrane_actions_mouse[8][12] = {
 };
 
 #define MOUSE_MOVE	(10)
+
+/*
+ * Holding a mouse pad direction moves the pointer continuously. A 1 ms
+ * timer, the USB mouse polling rate, clocks the motion. Pointer speed
+ * follows this curve of pixels per second against how long the direction
+ * has been held, interpolated between points. The first press moves
+ * MOUSE_MOVE pixels at once so a tap still nudges the pointer.
+ */
+#define MOUSE_TICK_US	(1000)
+static const struct {
+	uint16_t ms;
+	uint16_t speed;
+} mouse_curve[] = {
+	{    0,    0 },
+	{  250,    0 },
+	{ 1000,  600 },
+	{ 2500, 1500 },
+};
+
+// x,y direction for each mouse action
+static const int8_t mouse_dir[][2] = {
+	{ 0, 0},	// MOUSE_NONE
+	{-1,-1},	// MOUSE_MOVE_NW
+	{ 0,-1},	// MOUSE_MOVE_N
+	{ 1,-1},	// MOUSE_MOVE_NE
+	{-1, 0},	// MOUSE_MOVE_W
+	{ 0, 0},	// MOUSE_CLICK
+	{ 1, 0},	// MOUSE_MOVE_E
+	{-1, 1},	// MOUSE_MOVE_SW
+	{ 0, 1},	// MOUSE_MOVE_S
+	{ 1, 1},	// MOUSE_MOVE_SE
+};
+#define IS_MOUSE_MOVE(code) ((code) < sizeof(mouse_dir)/sizeof(mouse_dir[0]) && \
+		(mouse_dir[code][0] || mouse_dir[code][1]))
+
+static IntervalTimer mouse_timer;
+static volatile uint32_t mouse_ticks;	// written by mouse_tick() only
+static uint32_t mouse_ticks_seen;
+static uint16_t mouse_held;		// bit per held direction action
+static uint32_t mouse_hold_ms;
+static int32_t mouse_acc_x, mouse_acc_y;	// 1/1000 pixel
+static bool drag_lock=false;
+
+static void mouse_tick(void)
+{
+	mouse_ticks++;
+}
+
+static uint32_t mouse_speed(uint32_t ms)
+{
+	const size_t points = sizeof(mouse_curve)/sizeof(mouse_curve[0]);
+	for (size_t i = 1; i < points; i++) {
+		if (ms < mouse_curve[i].ms) {
+			uint32_t t0 = mouse_curve[i-1].ms, t1 = mouse_curve[i].ms;
+			int32_t v0 = mouse_curve[i-1].speed, v1 = mouse_curve[i].speed;
+			return v0 + ((v1 - v0) * (int32_t)(ms - t0)) / (int32_t)(t1 - t0);
+		}
+	}
+	return mouse_curve[points-1].speed;
+}
+
+static void mouse_move_start(uint16_t mousecode)
+{
+	if (mouse_held == 0) {
+		mouse_hold_ms = 0;
+		mouse_acc_x = mouse_acc_y = 0;
+		mouse_ticks_seen = mouse_ticks;
+		mouse_timer.begin(mouse_tick, MOUSE_TICK_US);
+	}
+	mouse_held |= (1 << mousecode);
+	Mouse.move(mouse_dir[mousecode][0] * MOUSE_MOVE,
+			mouse_dir[mousecode][1] * MOUSE_MOVE, 0, 0);
+}
+
+static void mouse_move_stop(uint16_t mousecode)
+{
+	mouse_held &= ~(1 << mousecode);
+	if (mouse_held == 0) mouse_timer.end();
+}
+
+static void drag_lock_set(IntelliKeys &ikey, bool on)
+{
+	drag_lock = on;
+	if (on) {
+		Mouse.press(MOUSE_LEFT);
+	} else {
+		Mouse.release(MOUSE_LEFT);
+	}
+	ikey.setLED(IntelliKeys::IK_LED_MOUSE, on);
+}
+
+/*
+ * Call from loop(). Turns the timer ticks since the last call into one
+ * Mouse.move().
+ */
+void keymouse_task(void)
+{
+	dwell.task(millis());
+	chords.task(millis());
+
+	uint32_t now = mouse_ticks;
+	uint32_t ticks = now - mouse_ticks_seen;
+	mouse_ticks_seen = now;
+	if (ticks == 0 || mouse_held == 0) return;
+	if (ticks > 100) ticks = 100;
+
+	int dx = 0, dy = 0;
+	for (uint16_t code = 0; code < sizeof(mouse_dir)/sizeof(mouse_dir[0]); code++) {
+		if (mouse_held & (1 << code)) {
+			dx += mouse_dir[code][0];
+			dy += mouse_dir[code][1];
+		}
+	}
+	dx = constrain(dx, -1, 1);
+	dy = constrain(dy, -1, 1);
+	while (ticks--) {
+		mouse_hold_ms += MOUSE_TICK_US / 1000;
+		int32_t speed = mouse_speed(mouse_hold_ms);
+		mouse_acc_x += dx * speed;
+		mouse_acc_y += dy * speed;
+	}
+	int32_t mx = constrain(mouse_acc_x / 1000, -127, 127);
+	int32_t my = constrain(mouse_acc_y / 1000, -127, 127);
+	mouse_acc_x -= mx * 1000;
+	mouse_acc_y -= my * 1000;
+	if (mx || my) Mouse.move(mx, my, 0, 0);
+}
 static bool num_lock=false;
 static bool caps_lock=false;
 static uint8_t shift_lock=0;	//0=off,1=on next key,2=lock on
@@ -247,28 +384,110 @@ static uint8_t ctrl_lock=0;	//0=off,1=on next key,2=lock on
 static uint8_t alt_lock=0;	//0=off,1=on next key,2=lock on
 static uint8_t gui_lock=0;	//0=off,1=on next key,2=lock on
 
+/*
+ * Chords are recognized alongside the normal key actions. Both SHIFT keys
+ * (regions 73 and 74) pressed together toggle CAPS LOCK instead of locking
+ * SHIFT.
+ */
+enum chord_ids {
+	CHORD_CAPS_LOCK = 1
+};
+static IntelliKeys *key_ikey;	// board of the last key press
+
+static void chord(int id)
+{
+	if (key_ikey == NULL) return;
+	switch (id) {
+		case CHORD_CAPS_LOCK:
+			shift_lock = 0;
+			key_ikey->setLED(IntelliKeys::IK_LED_SHIFT, 0);
+			Keyboard.release(MODIFIERKEY_SHIFT);
+			Keyboard.press(KEY_CAPS_LOCK);
+			Keyboard.release(KEY_CAPS_LOCK);
+			caps_lock = !caps_lock;
+			key_ikey->setLED(IntelliKeys::IK_LED_CAPS_LOCK, caps_lock);
+			break;
+		default:
+			break;
+	}
+}
+
+static void region_press(int region);
+static void region_release(int region);
+
+/*
+ * The arrow keys repeat under driver control instead of being held down, so
+ * the repeat rate is the same whatever the host's typematic settings are.
+ * Each repeat taps the key again.
+ */
+static bool is_arrow(uint16_t keycode)
+{
+	return keycode == KEY_LEFT || keycode == KEY_RIGHT ||
+		keycode == KEY_UP || keycode == KEY_DOWN;
+}
+
+static void key_repeat(int region)
+{
+	uint16_t keycode = membrane_actions[region / 12][region % 12];
+	Keyboard.press(keycode);
+	Keyboard.release(keycode);
+}
+
+void keymouse_begin(IntelliKeys &ikey)
+{
+	ikey.onRepeat(key_repeat);
+	dwell.setDwell(KEY_DWELL_MS);
+	dwell.onActivate(region_press);
+	dwell.onDeactivate(region_release);
+	chords.add(IK_CHORD_REGION(6*12 + 1) | IK_CHORD_REGION(6*12 + 2), CHORD_CAPS_LOCK);
+	chords.compile();
+	chords.onChord(chord);
+}
+
 void clear_membrane(void)
 {
-	memset((void *)membrane, 0, sizeof(membrane));
+	keymap.reset();
+	dwell.reset();
+	chords.reset();
+	if (key_ikey) key_ikey->repeatStopAll();
 	if (num_lock) Keyboard.press(KEY_NUM_LOCK);
 	if (caps_lock) Keyboard.press(KEY_CAPS_LOCK);
 	num_lock = caps_lock = false;
 	shift_lock = ctrl_lock = alt_lock = gui_lock = 0;
+	mouse_held = 0;
+	mouse_timer.end();
+	drag_lock = false;
 	Mouse.release(MOUSE_ALL);
 	Keyboard.releaseAll();
 }
 
 void process_membrane_release(IntelliKeys &ikey, int x, int y)
+{
+	int region = keymap.release(x, y);
+	if (region >= 0) dwell.release(region);
+}
+
+void process_membrane_press(IntelliKeys &ikey, int x, int y)
+{
+	int region = keymap.press(x, y);
+	if (region < 0) return;
+	key_ikey = &ikey;
+	dwell.press(region, millis());
+}
+
+// Called by dwell when an activated key is released
+static void region_release(int region)
 {
 	uint8_t row, col;
 	uint16_t keycode, mousecode;
-	col = x / 2;
-	row = y / 3;
-	membrane[row][col]--;
-	if (membrane[row][col] < 0) membrane[row][col] = 0;
-	if (membrane[row][col] != 0) return;
+	chords.releaseRegion(region);
+	col = region % 12;
+	row = region / 12;
 	keycode = membrane_actions[row][col];
-	if (keycode) {
+	if (is_arrow(keycode)) {
+		if (key_ikey) key_ikey->repeatStop(region);
+	}
+	else if (keycode) {
 		switch (keycode) {
 			case MODIFIERKEY_SHIFT:
 				/* fall through */
@@ -286,37 +505,7 @@ void process_membrane_release(IntelliKeys &ikey, int x, int y)
 	}
 	else {
 		mousecode = membrane_actions_mouse[row][col];
-		if (mousecode) {
-			switch (mousecode) {
-				case MOUSE_MOVE_NW:
-					break;
-				case MOUSE_MOVE_N:
-					break;
-				case MOUSE_MOVE_NE:
-					break;
-				case MOUSE_MOVE_W:
-					break;
-				case MOUSE_CLICK:
-					break;
-				case MOUSE_MOVE_E:
-					break;
-				case MOUSE_MOVE_SW:
-					break;
-				case MOUSE_MOVE_S:
-					break;
-				case MOUSE_MOVE_SE:
-					break;
-				case MOUSE_DOUBLE_CLICK:
-					break;
-				case MOUSE_RIGHT_CLICK:
-					break;
-				case MOUSE_PRESS:
-					// Mouse.?
-					break;
-				default:
-					break;
-			}
-		}
+		if (IS_MOUSE_MOVE(mousecode)) mouse_move_stop(mousecode);
 	}
 }
 
@@ -340,116 +529,114 @@ void process_locking(IntelliKeys &ikey, uint8_t &lock_status, uint8_t LED, uint1
 	}
 }
 
-void process_membrane_press(IntelliKeys &ikey, int x, int y)
+// Called by dwell when a key has been held long enough
+static void region_press(int region)
 {
+	IntelliKeys &ikey = *key_ikey;
 	uint8_t row, col;
 	uint16_t keycode, mousecode;
-	col = x / 2;
-	row = y / 3;
-	Serial.printf("col,row (%d,%d) membrane %d\n", col, row, membrane[row][col]);
-	if (membrane[row][col] == 0) {
-		keycode = membrane_actions[row][col];
-		if (keycode) {
-			Keyboard.press(keycode);
-			switch (keycode) {
-				case KEY_CAPS_LOCK:
-					caps_lock = !caps_lock;
-					ikey.setLED(IntelliKeys::IK_LED_CAPS_LOCK, caps_lock);
-					break;
-				case KEY_NUM_LOCK:
-					num_lock = !num_lock;
-					ikey.setLED(IntelliKeys::IK_LED_NUM_LOCK, num_lock);
-					break;
-				case MODIFIERKEY_SHIFT:
-					process_locking(ikey, shift_lock, IntelliKeys::IK_LED_SHIFT, keycode);
-					if (shift_lock == 0) ikey.setLED(IntelliKeys::IK_LED_SHIFT, 0);
-					break;
-				case MODIFIERKEY_ALT:
-					process_locking(ikey, alt_lock, IntelliKeys::IK_LED_ALT, keycode);
-					if (alt_lock == 0) ikey.setLED(IntelliKeys::IK_LED_ALT, 0);
-					break;
-				case MODIFIERKEY_CTRL:
-					process_locking(ikey, ctrl_lock, IntelliKeys::IK_LED_CTRL_CMD, keycode);
+	col = region % 12;
+	row = region / 12;
+	Serial.printf("col,row (%d,%d)\n", col, row);
+	keycode = membrane_actions[row][col];
+	if (is_arrow(keycode)) {
+		Keyboard.press(keycode);
+		Keyboard.release(keycode);
+		ikey.repeatStart(region);
+	}
+	else if (keycode) {
+		Keyboard.press(keycode);
+		switch (keycode) {
+			case KEY_CAPS_LOCK:
+				caps_lock = !caps_lock;
+				ikey.setLED(IntelliKeys::IK_LED_CAPS_LOCK, caps_lock);
+				break;
+			case KEY_NUM_LOCK:
+				num_lock = !num_lock;
+				ikey.setLED(IntelliKeys::IK_LED_NUM_LOCK, num_lock);
+				break;
+			case MODIFIERKEY_SHIFT:
+				process_locking(ikey, shift_lock, IntelliKeys::IK_LED_SHIFT, keycode);
+				if (shift_lock == 0) ikey.setLED(IntelliKeys::IK_LED_SHIFT, 0);
+				break;
+			case MODIFIERKEY_ALT:
+				process_locking(ikey, alt_lock, IntelliKeys::IK_LED_ALT, keycode);
+				if (alt_lock == 0) ikey.setLED(IntelliKeys::IK_LED_ALT, 0);
+				break;
+			case MODIFIERKEY_CTRL:
+				process_locking(ikey, ctrl_lock, IntelliKeys::IK_LED_CTRL_CMD, keycode);
+				if (!ctrl_lock && !gui_lock) {
+					ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
+				}
+				break;
+			case MODIFIERKEY_GUI:
+				process_locking(ikey, gui_lock, IntelliKeys::IK_LED_CTRL_CMD, keycode);
+				if (!ctrl_lock && !gui_lock) {
+					ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
+				}
+				break;
+			default:
+				if (shift_lock == 1) {
+					shift_lock = 0;
+					ikey.setLED(IntelliKeys::IK_LED_SHIFT, 0);
+					Keyboard.release(MODIFIERKEY_SHIFT);
+				}
+				if (alt_lock == 1) {
+					alt_lock = 0;
+					ikey.setLED(IntelliKeys::IK_LED_ALT, 0);
+					Keyboard.release(MODIFIERKEY_ALT);
+				}
+				if (ctrl_lock == 1) {
+					ctrl_lock = 0;
 					if (!ctrl_lock && !gui_lock) {
 						ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
 					}
-					break;
-				case MODIFIERKEY_GUI:
-					process_locking(ikey, gui_lock, IntelliKeys::IK_LED_CTRL_CMD, keycode);
+					Keyboard.release(MODIFIERKEY_CTRL);
+				}
+				if (gui_lock == 1) {
+					gui_lock = 0;
 					if (!ctrl_lock && !gui_lock) {
 						ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
 					}
+					Keyboard.release(MODIFIERKEY_GUI);
+				}
+				break;
+		}
+	}
+	else {
+		mousecode = membrane_actions_mouse[row][col];
+		if (mousecode) {
+			switch (mousecode) {
+				case MOUSE_MOVE_NW:
+				case MOUSE_MOVE_N:
+				case MOUSE_MOVE_NE:
+				case MOUSE_MOVE_W:
+				case MOUSE_MOVE_E:
+				case MOUSE_MOVE_SW:
+				case MOUSE_MOVE_S:
+				case MOUSE_MOVE_SE:
+					mouse_move_start(mousecode);
+					break;
+				case MOUSE_CLICK:
+					Mouse.click();
+					break;
+				case MOUSE_DOUBLE_CLICK:
+					Mouse.click();
+					Mouse.click();
+					break;
+				case MOUSE_RIGHT_CLICK:
+					Mouse.click(MOUSE_RIGHT);
+					break;
+				case MOUSE_PRESS:
+					// Drag lock. Press to hold the left button, press again
+					// to let go.
+					drag_lock_set(ikey, !drag_lock);
 					break;
 				default:
-					if (shift_lock == 1) {
-						shift_lock = 0;
-						ikey.setLED(IntelliKeys::IK_LED_SHIFT, 0);
-						Keyboard.release(MODIFIERKEY_SHIFT);
-					}
-					if (alt_lock == 1) {
-						alt_lock = 0;
-						ikey.setLED(IntelliKeys::IK_LED_ALT, 0);
-						Keyboard.release(MODIFIERKEY_ALT);
-					}
-					if (ctrl_lock == 1) {
-						ctrl_lock = 0;
-						if (!ctrl_lock && !gui_lock) {
-							ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
-						}
-						Keyboard.release(MODIFIERKEY_CTRL);
-					}
-					if (gui_lock == 1) {
-						gui_lock = 0;
-						if (!ctrl_lock && !gui_lock) {
-							ikey.setLED(IntelliKeys::IK_LED_CTRL_CMD, 0);
-						}
-						Keyboard.release(MODIFIERKEY_GUI);
-					}
 					break;
 			}
 		}
-		else {
-			mousecode = membrane_actions_mouse[row][col];
-			if (mousecode) {
-				switch (mousecode) {
-					case MOUSE_MOVE_NW:
-						Mouse.move(-MOUSE_MOVE, -MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_MOVE_N:
-						Mouse.move(0, -MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_MOVE_NE:
-						Mouse.move(MOUSE_MOVE, -MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_MOVE_W:
-						Mouse.move(-MOUSE_MOVE, 0, 0, 0);
-						break;
-					case MOUSE_CLICK:
-						Mouse.click();
-						break;
-					case MOUSE_MOVE_E:
-						Mouse.move(MOUSE_MOVE, 0, 0, 0);
-						break;
-					case MOUSE_MOVE_SW:
-						Mouse.move(MOUSE_MOVE, -MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_MOVE_S:
-						Mouse.move(0, MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_MOVE_SE:
-						Mouse.move(MOUSE_MOVE, MOUSE_MOVE, 0, 0);
-						break;
-					case MOUSE_DOUBLE_CLICK:
-						break;
-					case MOUSE_RIGHT_CLICK:
-						break;
-					case MOUSE_PRESS:
-						break;
-					default:
-						break;
-				}
-			}
-		}
 	}
-	membrane[row][col]++;
+	// After the key action so a chord can undo it
+	chords.pressRegion(region, millis());
 }
@@ -1,3 +1,5 @@
 void process_membrane_release(IntelliKeys &ikey, int x, int y);
 void process_membrane_press(IntelliKeys &ikey, int x, int y);
 void clear_membrane(void);
+void keymouse_begin(IntelliKeys &ikey);
+void keymouse_task(void);
@@ -27,6 +27,7 @@
 
 #include <USBHost_t36.h>
 #include <intellikeys.h>
+#include <ik_regionmap.h>
 #include <keymouse_play.h>
 #include <SD.h>
 #include <SPI.h>
@@ -34,7 +35,7 @@
 USBHost myusb;
 USBHub hub1(myusb);
 USBHub hub2(myusb);
-IntelliKeys ikey1(myusb);
+IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_FWLOAD> ikey1(myusb);
 keymouse_play keyplay;
 
 const int chipSelect = BUILTIN_SDCARD;
@@ -42,18 +43,15 @@ const int chipSelect = BUILTIN_SDCARD;
 bool Connected = false;
 
 /*
- * The native touch resolution is 24x24. For this example, each virtual button
- * is COLS native columns by ROWS rows. This array represents the ROWS rows of
- * COLS virtual buttons. The elements are incremented with each native touch
- * press and decremented with each native touch release. When the count goes
- * from 0 to 1, the corresponding key macro starts.
+ * The native touch resolution is 24x24. For this example, the touch area is
+ * divided into ROWS rows of COLS virtual buttons. The region map counts the
+ * native touches on each virtual button. When the count goes from 0 to 1,
+ * the corresponding key macro starts.
  */
 
-#define ROW_DIV (12)
-#define COL_DIV (8)
-#define ROWS    (24/ROW_DIV)
-#define COLS    (24/COL_DIV)
-uint8_t membrane[COLS][ROWS];
+#define ROWS    (2)
+#define COLS    (3)
+IKRegionMap keymap(COLS, ROWS);
 
 // Default key macros for switch 1 and 2. They can be overriden by
 // keymacros.txt stored on SD card.
@@ -70,24 +68,18 @@ char *macros[2+(ROWS*COLS)] = {(char *)youtube, (char *)google};
 void IK_press(int x, int y)
 {
   Serial.printf("membrane press (%d,%d)\n", x, y);
-  uint8_t row = y / ROW_DIV;
-  uint8_t col = x / COL_DIV;
-  if (membrane[col][row] == 0) {
-    uint8_t  macro_index = (row*COLS) + col + 2;
-    Serial.printf("x=%d col=%d y=%d row=%d idx=%d\n", x, col, y, row,
-        macro_index);
-    keyplay.start(macros[macro_index]);
-  }
-  membrane[col][row]++;
+  int region = keymap.press(x, y);
+  if (region < 0) return;
+  uint8_t macro_index = region + 2;
+  Serial.printf("x=%d col=%d y=%d row=%d idx=%d\n", x, region % COLS, y,
+      region / COLS, macro_index);
+  keyplay.start(macros[macro_index]);
 }
 
 void IK_release(int x, int y)
 {
   Serial.printf("membrane release (%d,%d)\n", x, y);
-  uint8_t row = y / ROW_DIV;
-  uint8_t col = x / COL_DIV;
-  membrane[col][row]--;
-  if (membrane[col][row] < 0) membrane[col][row] = 0;
+  keymap.release(x, y);
 }
 
 void IK_switch(int switch_number, int switch_state)
@@ -119,6 +111,7 @@ void IK_disconnect(void)
 void IK_onoff(int onoff)
 {
   Serial.printf("On/Off switch = %d\n", onoff);
+  keymap.reset();
   Keyboard.releaseAll();
   Mouse.release(MOUSE_ALL);
 }
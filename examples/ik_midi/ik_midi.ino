@@ -15,6 +15,8 @@
 
 #include <USBHost_t36.h>
 #include <intellikeys.h>
+#include <ik_regionmap.h>
+#include <ik_overlay.h>
 
 USBHost myusb;
 USBHub hub1(myusb);
@@ -32,13 +34,23 @@ const int MIDI_LOW = 21;
 
 /*
  * The native touch resolution is 24x24. For this example, each virtual button
- * is 2 native columns by 3 rows. This array represents the 8 rows of 12
- * virtual buttons. The elements are incremented with each native touch press
- * and decremented with each native touch release. When the count goes from 0
- * to 1, press action (see membrane_actions[]) is performed. When the count
- * goes from 1 to 0, the release action is performed.
+ * is 2 native columns by 3 rows giving 8 rows of 12 virtual buttons. The
+ * region map counts the native touches on each virtual button. When the count
+ * goes from 0 to 1, note on is sent. When the count goes from 1 to 0, note
+ * off is sent.
  */
-uint8_t membrane[8][12];
+IKRegionMap keymap(12, 8);
+
+/*
+ * An overlay with 8 large pads (4 columns by 2 rows) playing one octave from
+ * middle C. The overlay registry switches between the keymaps when the
+ * overlay bar code changes. Pads are used for overlay ID 1; every other
+ * overlay gets the piano keys.
+ */
+const int MIDI_MIDDLE_C = 60;
+IKRegionMap pads(4, 2);
+IKOverlayRegistry overlays;
+int note_base = MIDI_LOW;
 
 /*
  * The top left corner corresponds to the left most piano key. This plays MIDI
@@ -49,25 +61,19 @@ uint8_t membrane[8][12];
 void IK_press(int x, int y)
 {
   Serial.printf("membrane press (%d,%d)\n", x, y);
-  uint8_t row = y / 3;
-  uint8_t col = x / 2;
-  if (membrane[row][col] == 0) {
-	uint8_t midi_note_number = (row*12) + col + MIDI_LOW;
-    Serial.printf("MIDI note %d On\n", midi_note_number);
-	usbMIDI.sendNoteOn(midi_note_number, 127, channel);
-  }
-  membrane[row][col]++;
+  int region = overlays.press(x, y);
+  if (region < 0) return;
+  uint8_t midi_note_number = region + note_base;
+  Serial.printf("MIDI note %d On\n", midi_note_number);
+  usbMIDI.sendNoteOn(midi_note_number, 127, channel);
 }
 
 void IK_release(int x, int y)
 {
   Serial.printf("membrane release (%d,%d)\n", x, y);
-  uint8_t row = y / 3;
-  uint8_t col = x / 2;
-  membrane[row][col]--;
-  if (membrane[row][col] < 0) membrane[row][col] = 0;
-  if (membrane[row][col] != 0) return;
-  uint8_t midi_note_number = (row*12) + col + MIDI_LOW;
+  int region = overlays.release(x, y);
+  if (region < 0) return;
+  uint8_t midi_note_number = region + note_base;
   Serial.printf("MIDI note %d Off\n", midi_note_number);
   usbMIDI.sendNoteOff(midi_note_number, 0, channel);
 }
@@ -89,6 +95,17 @@ void IK_sensor(int sensor_number, int sensor_value)
   //Serial.printf("sensor[%d] = %d\n", sensor_number, sensor_value);
 }
 
+void IK_overlay(int id)
+{
+  Serial.printf("overlay %d\n", id);
+  overlays.select(id);
+}
+
+void IK_swap(int id, IKRegionMap *map)
+{
+  note_base = (map == &pads) ? MIDI_MIDDLE_C : MIDI_LOW;
+}
+
 void IK_version(int major, int minor)
 {
   Serial.printf("IK firmware Version %d.%d\n", major, minor);
@@ -108,7 +125,7 @@ void IK_onoff(int onoff)
 {
   Serial.printf("On/Off switch = %d\n", onoff);
   if (onoff == 0) {
-	memset((void *)membrane, 0, sizeof(membrane));
+	overlays.reset();
 	usbMIDI.sendControlChange(AllNotesOff, 0, channel);
 	usbMIDI.sendControlChange(AllSoundOff, 0, channel);
 	usbMIDI.sendControlChange(ResetAllControllers, 0, channel);
@@ -133,6 +150,10 @@ void setup() {
   ikey1.begin();
   ikey1.onConnect(IK_connect);
   ikey1.onDisconnect(IK_disconnect);
+  overlays.setDefault(&keymap);
+  overlays.add(1, &pads);
+  overlays.onSwap(IK_swap);
+  ikey1.onOverlayChange(IK_overlay);
   ikey1.onMembranePress(IK_press);
   ikey1.onMembraneRelease(IK_release);
   ikey1.onSwitch(IK_switch);
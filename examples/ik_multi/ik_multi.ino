@@ -0,0 +1,118 @@
+/*
+ * Demonstrate the use of the Teensy 3.6 IntelliKeys (IK) USB host driver.
+ * Two IKs side by side work as one 48x24 keyboard. The surface is divided
+ * into 8 columns by 4 rows of keys, 'a' to 'z' then '1' to '6', and the
+ * pressed keys of both boards go out together in one USB keyboard report.
+ * Plug both IKs into a USB hub on the Teensy host port. ikey1 is whichever
+ * IK the USB host claims first, not a position on the desk. "left" and
+ * "right" below only name that order, so plug in the left IK first or swap
+ * the two boards if the halves come out reversed.
+ *
+ * Set the USB Type to Keyboard + Serial.
+ */
+
+#include <USBHost_t36.h>
+#include <intellikeys.h>
+#include <ik_aggregate.h>
+
+USBHost myusb;
+USBHub hub1(myusb);
+USBHub hub2(myusb);
+
+// Only membrane, switch and batched events are needed. The firmware loader
+// is kept so each board can be loaded after power up.
+typedef IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH |
+	IK_FEATURE_EVENTS | IK_FEATURE_FWLOAD> Board;
+Board ikey1(myusb);
+Board ikey2(myusb);
+IKAggregator surface;
+
+#define SURFACE_X (2 * IK_RESOLUTION_X)
+#define SURFACE_Y IK_RESOLUTION_Y
+#define KEY_SIZE  6
+#define KEY_COLS  (SURFACE_X / KEY_SIZE)
+#define KEY_ROWS  (SURFACE_Y / KEY_SIZE)
+#define KEYS      (KEY_COLS * KEY_ROWS)
+
+// Pressed cells on each key. A key is down while any of its cells is.
+uint8_t key_cells[KEYS];
+
+// First 6 keys down, as USB keyboard usage codes. Usage 4 is 'a'.
+void send_report(void)
+{
+  uint8_t keys[6] = {0};
+  int n = 0;
+
+  for (int k = 0; k < KEYS && n < 6; k++) {
+    if (key_cells[k]) keys[n++] = 4 + k;
+  }
+  Keyboard.set_key1(keys[0]);
+  Keyboard.set_key2(keys[1]);
+  Keyboard.set_key3(keys[2]);
+  Keyboard.set_key4(keys[3]);
+  Keyboard.set_key5(keys[4]);
+  Keyboard.set_key6(keys[5]);
+  Keyboard.send_now();
+}
+
+// Every event from both boards since the last surface.task(), oldest first
+void IK_events(const ik_board_event_t *events, size_t count)
+{
+  bool changed = false;
+
+  for (size_t i = 0; i < count; i++) {
+    const ik_board_event_t &e = events[i];
+    if (e.type != IK_EVENT_MEMBRANE_PRESS && e.type != IK_EVENT_MEMBRANE_RELEASE) continue;
+    if (e.x >= SURFACE_X || e.y >= SURFACE_Y) continue;
+    int key = (e.y / KEY_SIZE) * KEY_COLS + e.x / KEY_SIZE;
+    if (e.type == IK_EVENT_MEMBRANE_PRESS) {
+      key_cells[key]++;
+    } else if (key_cells[key]) {
+      key_cells[key]--;
+    }
+    changed = true;
+  }
+  if (changed) send_report();
+}
+
+void IK_switch(int switch_number, int switch_state)
+{
+  Serial.printf("switch[%d] = %d\n", switch_number, switch_state);
+}
+
+// The board name comes in as the delegate context
+void IK_connect(void *name)
+{
+  Serial.printf("IK %s connect\n", (const char *)name);
+}
+
+void IK_disconnect(void *name)
+{
+  Serial.printf("IK %s disconnect\n", (const char *)name);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial && millis() < 2000) ; // wait for Arduino Serial Monitor
+  Serial.println("IntelliKeys USB Test");
+  myusb.begin();
+
+  ikey1.begin();
+  ikey2.begin();
+  ikey1.onConnect(IKDelegate<>(IK_connect, (void *)"left"));
+  ikey2.onConnect(IKDelegate<>(IK_connect, (void *)"right"));
+  ikey1.onDisconnect(IKDelegate<>(IK_disconnect, (void *)"left"));
+  ikey2.onDisconnect(IKDelegate<>(IK_disconnect, (void *)"right"));
+
+  // The second board claimed starts at x 24. Its switches are numbered
+  // after the first board's.
+  surface.add(ikey1, 0, 0);
+  surface.add(ikey2, IK_RESOLUTION_X, 0, IK_NUM_SWITCHES);
+  surface.onEvents(IK_events);
+  surface.onSwitch(IK_switch);
+}
+
+void loop() {
+  myusb.Task();
+  surface.task();
+}
@@ -0,0 +1,150 @@
+/* IntelliKeys debounce replay benchmark
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Replays one recorded-style trace of touches with contact chatter through
+ * the driver at several debounce windows and prints how many raw events
+ * were filtered and how much latency the confirmed events gained. Every
+ * run must end with no cell held. Also checks that changing the windows
+ * while a cell is held does not lose its release.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_DEBOUNCE> ik(host);
+static SimBoard board;
+
+typedef struct {
+	uint32_t ms;
+	uint8_t type, x, y;
+} raw_t;
+
+static std::vector<raw_t> trace;
+static int presses, releases;
+
+static void cb_press(int, int) { presses++; }
+static void cb_release(int, int) { releases++; }
+
+static uint32_t lcg = 4321;
+static uint32_t rnd(uint32_t n)
+{
+	lcg = lcg * 1103515245 + 12345;
+	return (lcg >> 8) % n;
+}
+
+// Chatter: up to 3 extra release/press pairs 1 to 4 ms apart
+static uint32_t chatter(uint32_t t, uint8_t first, uint8_t x, uint8_t y)
+{
+	uint8_t other = (first == IK_EVENT_MEMBRANE_PRESS) ? IK_EVENT_MEMBRANE_RELEASE : IK_EVENT_MEMBRANE_PRESS;
+	trace.push_back({t, first, x, y});
+	for (uint32_t n = rnd(4); n > 0; n--) {
+		t += 1 + rnd(4);
+		trace.push_back({t, other, x, y});
+		t += 1 + rnd(4);
+		trace.push_back({t, first, x, y});
+	}
+	return t;
+}
+
+static void make_trace(void)
+{
+	uint32_t t = 10;
+	for (int i = 0; i < 500; i++) {
+		uint8_t x = rnd(24), y = rnd(24);
+		if (rnd(5) == 0) {
+			// Brushed a cell
+			trace.push_back({t, IK_EVENT_MEMBRANE_PRESS, x, y});
+			trace.push_back({t + 1 + rnd(2), IK_EVENT_MEMBRANE_RELEASE, x, y});
+		} else {
+			t = chatter(t, IK_EVENT_MEMBRANE_PRESS, x, y);
+			t = chatter(t + 30 + rnd(170), IK_EVENT_MEMBRANE_RELEASE, x, y);
+		}
+		t += 20 + rnd(200);
+	}
+}
+
+static void run_to(uint32_t ms)
+{
+	while (millis() < ms) {
+		sim_us += 1000;
+		ik.Task();
+	}
+}
+
+static int held_after_window_change(void)
+{
+	ik.setDebounce(5, 5);
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 3, 3});
+	run_to(millis() + 10);
+	ik.setDebounce(10, 10);
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 3, 3});
+	run_to(millis() + 20);
+	// Enabled while a cell is already held
+	ik.setDebounce(0, 0);
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 4, 4});
+	ik.Task();
+	ik.setDebounce(5, 5);
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 4, 4});
+	run_to(millis() + 10);
+	return ik.membraneCount();
+}
+
+int main()
+{
+	static const uint16_t windows[] = {0, 3, 5, 10, 20};
+	int failed = 0;
+
+	ik.onMembranePress(cb_press);
+	ik.onMembraneRelease(cb_release);
+	board.attach(ik);
+	board.step(400);
+
+	if (held_after_window_change()) {
+		printf("FAIL: release lost after setDebounce\n");
+		failed = 1;
+	}
+
+	make_trace();
+	printf("raw events %u\n", (unsigned)trace.size());
+	printf("window ms | presses | filtered | delayed | mean added ms\n");
+	for (size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); w++) {
+		ik_debounce_stats_t st;
+		uint32_t base = millis() + 10;
+		presses = releases = 0;
+		ik.setDebounce(windows[w], windows[w]);
+		for (size_t i = 0; i < trace.size(); i++) {
+			run_to(base + trace[i].ms);
+			sim_report(ik, {trace[i].type, trace[i].x, trace[i].y});
+		}
+		run_to(millis() + 100);
+		ik.getDebounceStats(&st);
+		printf("%9u | %7d | %8u | %7u | %.1f\n", windows[w], presses, st.filtered,
+				st.delayed, st.delayed ? (double)st.delay_ms / st.delayed : 0.0);
+		if (presses != releases || ik.membraneCount()) {
+			printf("FAIL: %d cells left held\n", ik.membraneCount());
+			failed = 1;
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,105 @@
+/* IntelliKeys fast path latency benchmark
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Cost of the two ways a membrane press reaches the sketch, measured with
+ * the host clock: rx_data() to onMembraneISR inside the USB interrupt, and
+ * Task() draining the ring to onMembranePress. These are host CPU times,
+ * so only the ratio carries over to a Teensy. Both include one clock read.
+ *
+ * The second table is a model, not a measurement. A report waits for the
+ * next Task() call, on average half a loop() period and at most a whole
+ * one, before the deferred path starts. The ISR path does not wait.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH> ik(host);
+static SimBoard board;
+
+typedef std::chrono::steady_clock host_clock;
+static host_clock::time_point start, hit;
+
+static void cb_isr(int, int, int state) { if (state) hit = host_clock::now(); }
+static void cb_press(int, int) { hit = host_clock::now(); }
+
+// Put a report in rxpacket[0] and enter the driver's USB interrupt handler
+static void rx_start(uint8_t type, uint8_t x, uint8_t y)
+{
+	Transfer_t t = {};
+
+	memset(ik.rxpacket[0], 0, 64);
+	ik.rxpacket[0][0] = type;
+	ik.rxpacket[0][1] = x;
+	ik.rxpacket[0][2] = y;
+	t.driver = &ik;
+	t.length = IK_REPORT_LEN;
+	start = host_clock::now();
+	IntelliKeysBase::rx_callback1(&t);
+}
+
+static uint32_t elapsed_ns(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(hit - start).count();
+}
+
+int main()
+{
+	static const uint32_t periods[] = {100, 1000, 5000, 20000};
+	const int presses = 100000;
+	static std::vector<uint32_t> isr_ns, task_ns;
+
+	ik.onMembraneISR(cb_isr);
+	ik.onMembranePress(cb_press);
+	board.attach(ik);
+	board.step(400);
+
+	for (int i = 0; i < presses; i++) {
+		uint8_t x = i % 24, y = (i / 24) % 24;
+		rx_start(IK_EVENT_MEMBRANE_PRESS, x, y);
+		isr_ns.push_back(elapsed_ns());
+		start = host_clock::now();
+		ik.Task();
+		task_ns.push_back(elapsed_ns());
+		rx_start(IK_EVENT_MEMBRANE_RELEASE, x, y);
+		ik.Task();
+	}
+	std::sort(isr_ns.begin(), isr_ns.end());
+	std::sort(task_ns.begin(), task_ns.end());
+	uint32_t isr = isr_ns[presses / 2], task = task_ns[presses / 2];
+	printf("measured, host ns     | median | 99th pct\n");
+	printf("rx_data to ISR cb     | %6u | %u\n", isr, isr_ns[presses * 99 / 100]);
+	printf("Task to press cb      | %6u | %u\n", task, task_ns[presses * 99 / 100]);
+
+	printf("model: loop period us | ISR mean/max us | deferred mean/max us\n");
+	for (size_t p = 0; p < sizeof(periods)/sizeof(periods[0]); p++) {
+		uint32_t period = periods[p];
+		printf("%21u | %6.1f / %-6.1f | %8.1f / %.1f\n", period,
+				isr / 1000.0, isr / 1000.0,
+				period / 2 + task / 1000.0, period + task / 1000.0);
+	}
+	return 0;
+}
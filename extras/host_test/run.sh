@@ -0,0 +1,64 @@
+#!/bin/bash
+# Build the library against the stubs/ headers and run the host tests and
+# benchmarks. Tests with a .expected file must print exactly that.
+# UPDATE=1 ./run.sh rewrites the .expected files instead.
+cd "$(dirname "$0")"
+ROOT=../..
+OUT="${TMPDIR:-/tmp}/ik_host_test_$$"
+CXX="${CXX:-g++}"
+# The calibration write is built in so test_calibration can model it
+CXXFLAGS="-std=gnu++14 -g -Wall -Wextra -Istubs -I. -I${ROOT} -DIK_EXPERIMENTAL_EEPROM_WRITE=1"
+# intellikeys.cpp casts pointers to uint32_t for the 32 bit Teensy. That
+# only fails on a 64 bit host, so allow it there and nowhere else.
+PERMISSIVE="-fpermissive"
+mkdir -p "${OUT}/baseline"
+trap 'rm -rf "${OUT}"' EXIT
+FAILED=0
+
+# build <dir> <extra flags>: compile the library objects into <dir>
+build()
+{
+    OBJS=""
+    for src in sim.cpp ${ROOT}/intellikeys.cpp ${ROOT}/ik_*.cpp
+    do
+        obj="$1/$(basename ${src} .cpp).o"
+        flags="${CXXFLAGS} $2"
+        [ "$(basename ${src})" = intellikeys.cpp ] && flags="${flags} ${PERMISSIVE}"
+        ${CXX} ${flags} -c "${src}" -o "${obj}" || exit 1
+        OBJS="${OBJS} ${obj}"
+    done
+}
+
+# run <dir> <extra flags> <sources...>: build and run each test
+run()
+{
+    dir="$1"
+    extra="$2"
+    shift 2
+    for src in "$@"
+    do
+        name="$(basename ${src} .cpp)"
+        echo "=== ${name}${extra:+ (${extra})}"
+        if ! ${CXX} ${CXXFLAGS} ${extra} "${src}" ${OBJS} -o "${dir}/${name}"
+        then
+            FAILED=1
+            continue
+        fi
+        if [ -n "${UPDATE}" ] && [ -z "${extra}" ] && [ -f "${name}.expected" ]
+        then
+            "${dir}/${name}" > "${name}.expected" || FAILED=1
+        elif [ -f "${name}.expected" ]
+        then
+            "${dir}/${name}" > "${dir}/${name}.txt" && diff -u "${name}.expected" "${dir}/${name}.txt" || FAILED=1
+        else
+            "${dir}/${name}" || FAILED=1
+        fi
+    done
+}
+
+build "${OUT}" ""
+run "${OUT}" "" test_*.cpp bench_*.cpp
+# The IK_IRQ_BASELINE measurement build must behave the same
+build "${OUT}/baseline" "-DIK_IRQ_BASELINE=1"
+run "${OUT}/baseline" "-DIK_IRQ_BASELINE=1" test_*.cpp
+exit ${FAILED}
@@ -0,0 +1,170 @@
+/* IntelliKeys host test simulator
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sim.h"
+
+uint32_t sim_us;
+USBHost sim_host;
+SerialT Serial;
+EEPROMClass EEPROM;
+volatile uint32_t ARM_DWT_CYCCNT, ARM_DEMCR, ARM_DWT_CTRL;
+
+uint32_t millis(void) { return sim_us / 1000; }
+uint32_t micros(void) { return sim_us; }
+
+static Pipe_t pipes[64];
+static int npipes;
+// Boards are constructed before main(), so the list must not depend on
+// static initialization order.
+static std::vector<SimBoard *> &boards(void)
+{
+	static std::vector<SimBoard *> list;
+	return list;
+}
+
+// Pipes are never freed, so reuse them round robin
+Pipe_t *sim_new_pipe(uint32_t, uint32_t, uint32_t)
+{
+	return &pipes[npipes++ % 64];
+}
+
+// IN transfers (64 bytes) are requeued by the driver and need nothing here.
+bool sim_queue_data(Pipe_t *, void *buffer, uint32_t len, USBDriver *driver)
+{
+	if (len == 64) return true;
+	for (SimBoard *b : boards()) {
+		if (b->ik == driver) b->tx.push_back((uint8_t *)buffer);
+	}
+	return true;
+}
+
+void sim_report(IntelliKeysBase &ik, const uint8_t *report, size_t len)
+{
+	memset(ik.rxpacket[0], 0, 64);
+	memcpy(ik.rxpacket[0], report, len);
+	Transfer_t t = {};
+	t.driver = &ik;
+	t.length = IK_REPORT_LEN;
+	IntelliKeysBase::rx_callback1(&t);
+}
+
+void sim_report(IntelliKeysBase &ik, std::initializer_list<uint8_t> report)
+{
+	sim_report(ik, report.begin(), report.size());
+}
+
+SimBoard::SimBoard() : ik(NULL), drop_writes(0)
+{
+	memcpy(eeprom, "SN-HOSTTEST-0123456789ABCDEFG", 29);
+	memset(eeprom + 29, 40, 3);
+	memset(eeprom + 32, 200, 3);
+	memset(sensor, 190, sizeof(sensor));
+	memset(held, 0, sizeof(held));
+	boards().push_back(this);
+}
+
+void SimBoard::attach(IntelliKeysBase &driver)
+{
+	static const uint8_t desc[] = {
+		9, 4, 0, 0, 4, 3, 0, 0, 0,
+		7, 5, 0x81, 3, 8, 0, 10,
+		7, 5, 0x02, 3, 8, 0, 10,
+		7, 5, 0x83, 3, 8, 0, 10,
+		7, 5, 0x84, 3, 8, 0, 10,
+	};
+	static Device_t dev = {0x095e, 0x0101};
+	ik = &driver;
+	tx.clear();
+	replies.clear();
+	driver.device = &dev;
+	driver.claim(&dev, 1, desc, sizeof(desc));
+}
+
+/*
+ * READBYTE carries the address low byte first, 0x1F80 + offset. WRITE is
+ * modelled with the same address bytes and the data in byte 3, as the
+ * driver sends it.
+ */
+#define SIM_EEPROM_BASE 0x1F80
+
+void SimBoard::command(const uint8_t *c)
+{
+	uint16_t addr = c[1] | (c[2] << 8);
+	char b[64];
+	snprintf(b, sizeof(b), "cmd %d %d %d %d", c[0], c[1], c[2], c[3]);
+	commands.push_back(b);
+	switch (c[0]) {
+		case IK_CMD_GET_VERSION:
+			replies.push_back({IK_EVENT_VERSION, 3, 7});
+			break;
+		case IK_CMD_EEPROM_READBYTE:
+			if (addr >= SIM_EEPROM_BASE && addr < SIM_EEPROM_BASE + sizeof(eeprom))
+				replies.push_back({IK_EVENT_EEPROM_READBYTE, eeprom[addr - SIM_EEPROM_BASE], c[1]});
+			break;
+		case IK_CMD_EEPROM_WRITE:
+			if (drop_writes > 0) {
+				drop_writes--;
+				break;
+			}
+			if (addr >= SIM_EEPROM_BASE && addr < SIM_EEPROM_BASE + sizeof(eeprom))
+				eeprom[addr - SIM_EEPROM_BASE] = c[3];
+			break;
+		case IK_CMD_ALL_SENSORS:
+			for (int i = 0; i < 3; i++) replies.push_back({IK_EVENT_SENSOR_CHANGE, (uint8_t)i, sensor[i]});
+			replies.push_back({IK_EVENT_ALL_SENSORS});
+			break;
+		case IK_CMD_CORRECT:
+			for (int x = 0; x < 24; x++) {
+				for (int y = 0; y < 24; y++) {
+					if (held[x][y]) replies.push_back({IK_EVENT_CORRECT_MEMBRANE, (uint8_t)x, (uint8_t)y});
+				}
+			}
+			replies.push_back({IK_EVENT_CORRECT_DONE});
+			break;
+		default:
+			break;
+	}
+}
+
+void SimBoard::step(uint32_t ms)
+{
+	while (ms--) {
+		sim_us += 1000;
+		if (!tx.empty()) {
+			uint8_t c[IK_REPORT_LEN];
+			Transfer_t t = {};
+			memcpy(c, tx.front(), sizeof(c));
+			t.driver = ik;
+			t.buffer = tx.front();
+			t.length = IK_REPORT_LEN;
+			tx.pop_front();
+			IntelliKeysBase::tx_callback(&t);
+			command(c);
+		}
+		for (int i = 0; i < 4 && !replies.empty(); i++) {
+			sim_report(*ik, replies.front().data(), replies.front().size());
+			replies.pop_front();
+		}
+		ik->Task();
+	}
+}
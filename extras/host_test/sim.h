@@ -0,0 +1,76 @@
+/* IntelliKeys host test simulator
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host side stand-in for the USB host controller and an IntelliKeys board.
+ * The library sources are compiled against the stubs/ headers and driven
+ * by a simulated clock, so timing measured here is in simulated time.
+ */
+
+#ifndef _IK_SIM_H_
+#define _IK_SIM_H_
+
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <Arduino.h>
+#include <USBHost_t36.h>
+#include <EEPROM.h>
+// The tests look at driver internals
+#define private public
+#define protected public
+#include "intellikeys.h"
+#undef private
+#undef protected
+
+// Simulated time. millis() is sim_us / 1000.
+extern uint32_t sim_us;
+extern USBHost sim_host;
+
+// One simulated board. The board handles one OUT report per ms and its
+// replies reach the driver the ms after.
+struct SimBoard {
+	IntelliKeysBase *ik;
+	uint8_t eeprom[35];		// serial number, black, white
+	uint8_t sensor[3];
+	bool held[24][24];
+	int drop_writes;		// EEPROM_WRITE reports to ignore
+	std::deque<uint8_t *> tx;
+	std::deque<std::vector<uint8_t> > replies;
+	std::vector<std::string> commands;
+
+	SimBoard();
+	void attach(IntelliKeysBase &driver);
+	void step(uint32_t ms = 1);
+	void command(const uint8_t *c);
+};
+
+// Deliver one IN report to a driver the way the USB interrupt does.
+void sim_report(IntelliKeysBase &ik, std::initializer_list<uint8_t> report);
+void sim_report(IntelliKeysBase &ik, const uint8_t *report, size_t len);
+
+#define SIM_LOG(...) do { printf("%5u ", millis()); printf(__VA_ARGS__); printf("\n"); } while (0)
+
+#endif
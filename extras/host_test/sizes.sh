@@ -0,0 +1,56 @@
+#!/bin/bash
+# RAM and code size of IntelliKeysT feature configurations, built as 32 bit
+# x86 against the stubs/ headers with unused code dropped. RAM is the size
+# of the driver object. The stub USB structures are smaller than the real
+# ones, which adds the same amount to every configuration on a Teensy.
+# Code is x86 -Os, not Thumb-2, so only the differences carry over. Needs
+# g++ with -m32 support, the C library's 32 bit headers are not used.
+cd "$(dirname "$0")"
+ROOT=../..
+OUT="${TMPDIR:-/tmp}/ik_sizes_$$"
+CXX="${CXX:-g++}"
+mkdir -p "${OUT}/inc/gnu"
+trap 'rm -rf "${OUT}"' EXIT
+# The 64 bit C library headers stand in for the missing 32 bit ones
+touch "${OUT}/inc/gnu/stubs-32.h"
+# Type sizes come from -m32, not from the 64 bit library headers used here
+CXXCONF="$(dirname $(echo '#include <cstdlib>' | ${CXX} -x c++ -H -fsyntax-only - 2>&1 |
+	grep -m1 'c++config.h' | awk '{print $2}'))/.."
+CXXFLAGS="-m32 -std=gnu++14 -Os -ffunction-sections -fdata-sections -w
+	-I${OUT}/inc -idirafter /usr/include/x86_64-linux-gnu -idirafter ${CXXCONF}
+	-Istubs -I${ROOT}"
+OBJS=""
+for src in ${ROOT}/intellikeys.cpp ${ROOT}/ik_*.cpp
+do
+    obj="${OUT}/$(basename ${src} .cpp).o"
+    ${CXX} ${CXXFLAGS} -c "${src}" -o "${obj}" || exit 1
+    OBJS="${OBJS} ${obj}"
+done
+size_of() {
+    local name="$1" mask="$2"
+    cat > "${OUT}/${name}.cpp" <<EOT
+#include <Arduino.h>
+#include <USBHost_t36.h>
+#include "intellikeys.h"
+USBHost sz_host;
+IntelliKeysT<${mask}> sz_ik(sz_host);
+extern "C" void sz_root(void) { sz_ik.begin(); }
+EOT
+    ${CXX} ${CXXFLAGS} -c "${OUT}/${name}.cpp" -o "${OUT}/${name}.o" || exit 1
+    ld -m elf_i386 -r --gc-sections -u sz_root -e sz_root "${OUT}/${name}.o" ${OBJS} \
+        -o "${OUT}/${name}.r.o" || exit 1
+    local ram=$((0x$(nm -S -C "${OUT}/${name}.r.o" | awk '$4 == "sz_ik" { print $2 }')))
+    local code=$(size "${OUT}/${name}.r.o" | awk 'NR == 2 { print $1 + $2 }')
+    printf "%-40s | %5u | %6u\n" "${name}" "${ram}" "${code}"
+}
+printf "%-40s | %5s | %6s\n" "configuration" "RAM" "code"
+size_of "IntelliKeys (IK_FEATURE_ALL)" "IK_FEATURE_ALL"
+size_of "ALL without FWLOAD" "IK_FEATURE_ALL & ~IK_FEATURE_FWLOAD"
+size_of "ik_multi: MEMBRANE|SWITCH|EVENTS|FWLOAD" "IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_EVENTS | IK_FEATURE_FWLOAD"
+size_of "KeyMacro: MEMBRANE|SWITCH|FWLOAD" "IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_FWLOAD"
+size_of "MEMBRANE|SWITCH" "IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH"
+size_of "MEMBRANE" "IK_FEATURE_MEMBRANE"
+for f in SENSORS EEPROM DEBOUNCE REPEAT EVENTS REQUESTS RESYNC
+do
+    size_of "MEMBRANE|SWITCH|${f}" "IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_${f}"
+done
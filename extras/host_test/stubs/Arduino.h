@@ -0,0 +1,48 @@
+// Minimal Arduino core stand-in for the host tests
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#define HEX 16
+#define F_CPU 180000000
+
+uint32_t millis(void);
+uint32_t micros(void);
+
+struct SerialT {
+	template <class... A> int printf(A...) { return 0; }
+	void write(const char *) {}
+	void println(const char *) {}
+};
+extern SerialT Serial;
+
+class elapsedMillis {
+	uint32_t ms;
+public:
+	elapsedMillis() { ms = millis(); }
+	operator uint32_t() const { return millis() - ms; }
+	elapsedMillis &operator=(uint32_t v) { ms = millis() - v; return *this; }
+};
+
+class elapsedMicros {
+	uint32_t us;
+public:
+	elapsedMicros() { us = micros(); }
+	operator uint32_t() const { return micros() - us; }
+	elapsedMicros &operator=(uint32_t v) { us = micros() - v; return *this; }
+};
+
+#define __disable_irq() do {} while (0)
+#define __enable_irq() do {} while (0)
+#define NVIC_DISABLE_IRQ(n) do {} while (0)
+#define NVIC_ENABLE_IRQ(n) do {} while (0)
+#define NVIC_IS_ENABLED(n) 1
+#define IRQ_USBHS 1
+#define __LDREXW(p) (*(p))
+#define __STREXW(v, p) ((*(p) = (v)), 0)
+
+extern volatile uint32_t ARM_DWT_CYCCNT, ARM_DEMCR, ARM_DWT_CTRL;
+#define ARM_DEMCR_TRCENA (1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA 1
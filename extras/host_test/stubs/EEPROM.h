@@ -0,0 +1,23 @@
+// Teensy EEPROM stand-in for the host tests. writes counts byte writes.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+struct EEPROMClass {
+	uint8_t mem[2048];
+	uint32_t writes;
+	uint8_t read(int a) { return mem[a]; }
+	void write(int a, uint8_t v) { mem[a] = v; writes++; }
+	void update(int a, uint8_t v) { if (mem[a] != v) write(a, v); }
+	uint16_t length() { return sizeof(mem); }
+	template <typename T> T &get(int a, T &t) {
+		memcpy(&t, mem + a, sizeof(T));
+		return t;
+	}
+	template <typename T> const T &put(int a, const T &t) {
+		const uint8_t *p = (const uint8_t *)&t;
+		for (size_t i = 0; i < sizeof(T); i++) update(a + i, p[i]);
+		return t;
+	}
+};
+extern EEPROMClass EEPROM;
@@ -0,0 +1,55 @@
+// USBHost_t36 stand-in for the host tests. Pipes and transfers are handed
+// to sim.cpp instead of a host controller.
+#pragma once
+#include "Arduino.h"
+
+struct Device_t { uint16_t idVendor, idProduct; };
+struct Pipe_t { void (*callback_function)(const struct Transfer_t *); };
+struct qtd_t { uint32_t token; };
+struct setup_t { uint32_t word1, word2; };
+struct Transfer_t { void *driver; void *buffer; uint32_t length; qtd_t qtd; setup_t setup; };
+struct strbuf_t { int x; };
+
+class USBDriver;
+class USBDriverTimer {
+public:
+	USBDriverTimer(USBDriver *) {}
+	void start(uint32_t) {}
+	void stop() {}
+};
+
+Pipe_t *sim_new_pipe(uint32_t type, uint32_t ep, uint32_t dir);
+bool sim_queue_data(Pipe_t *pipe, void *buffer, uint32_t len, USBDriver *driver);
+
+class USBHost {
+public:
+	static void print_(const char *) {}
+	template <class T> static void print_(const char *, T, int = 10) {}
+	static void print_(uint32_t, int = 10) {}
+	static void println_(const char *) {}
+	template <class T> static void println_(const char *, T, int = 10) {}
+	static void println_(uint32_t, int = 10) {}
+	static void print_hexbytes(const void *, uint32_t) {}
+	static void contribute_Pipes(Pipe_t *, uint32_t) {}
+	static void contribute_Transfers(Transfer_t *, uint32_t) {}
+	static void contribute_String_Buffers(strbuf_t *, uint32_t) {}
+	static void driver_ready_for_device(USBDriver *) {}
+	static void mk_setup(setup_t &, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) {}
+	Pipe_t *new_Pipe(Device_t *, uint32_t type, uint32_t ep, uint32_t dir, uint32_t, uint32_t = 0) {
+		return sim_new_pipe(type, ep, dir);
+	}
+	bool queue_Data_Transfer(Pipe_t *p, void *b, uint32_t l, USBDriver *d) {
+		return sim_queue_data(p, b, l, d);
+	}
+	bool queue_Control_Transfer(Device_t *, setup_t *, void *, USBDriver *) { return true; }
+};
+
+class USBDriver : public USBHost {
+public:
+	Device_t *device;
+	virtual bool claim(Device_t *, int, const uint8_t *, uint32_t) = 0;
+	virtual void control(const Transfer_t *) {}
+	virtual void disconnect() {}
+	virtual void timer_event(USBDriverTimer *) {}
+	virtual void Task() {}
+};
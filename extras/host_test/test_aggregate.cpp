@@ -0,0 +1,139 @@
+/* IntelliKeys multi-board aggregator host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Two simulated boards joined by IKAggregator: events merged in arrival
+ * order, overlapping boards, a board unplugged while holding a cell and a
+ * switch, and a burst larger than the aggregator queue.
+ */
+
+#include "sim.h"
+#define private public
+#include "ik_aggregate.h"
+#undef private
+
+typedef IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_EVENTS> Board;
+static Board left(sim_host), right(sim_host);
+static IntelliKeysT<IK_FEATURE_MEMBRANE> noevents(sim_host);
+static SimBoard left_board, right_board;
+static IKAggregator agg;
+
+static void cb_press(int x, int y) { SIM_LOG("press %d %d", x, y); }
+static void cb_release(int x, int y) { SIM_LOG("release %d %d", x, y); }
+static void cb_switch(int n, int s) { SIM_LOG("switch %d %d", n, s); }
+
+static void cb_events(const ik_board_event_t *e, size_t count)
+{
+	printf("%5u events", millis());
+	for (size_t i = 0; i < count; i++) {
+		printf(" [%u %d %d %d b%d]", e[i].time, e[i].type, e[i].x, e[i].y, e[i].board);
+	}
+	printf("\n");
+}
+
+static int presses;
+static void cb_count(int, int) { presses++; }
+static void cb_events_count(const ik_board_event_t *e, size_t count)
+{
+	SIM_LOG("events count=%u first=%d,%d", (unsigned)count, e[0].x, e[0].y);
+}
+
+// One loop() pass
+static void pass(void)
+{
+	sim_us += 1000;
+	left.Task();
+	right.Task();
+	agg.task();
+}
+
+int main()
+{
+	left.begin();
+	right.begin();
+	left_board.attach(left);
+	right_board.attach(right);
+	left_board.step(400);
+	right_board.step(400);
+	SIM_LOG("ready %d %d", left.ready(), right.ready());
+
+	int a = agg.add(left, 0, 0, 0);
+	int b = agg.add(right, IK_RESOLUTION_X, 0, IK_NUM_SWITCHES);
+	int c = agg.add(noevents, 0, 0);
+	SIM_LOG("add %d %d %d", a, b, c);
+	agg.onMembranePress(cb_press);
+	agg.onMembraneRelease(cb_release);
+	agg.onSwitch(cb_switch);
+	agg.onEvents(cb_events);
+
+	// The right board's report arrives first but the left board's Task()
+	// runs first. The events still come out in arrival order.
+	sim_report(right, {IK_EVENT_MEMBRANE_PRESS, 1, 2});
+	sim_us += 1000;
+	sim_report(left, {IK_EVENT_MEMBRANE_PRESS, 3, 4});
+	sim_report(left, {IK_EVENT_SWITCH, 0, 1});
+	sim_report(right, {IK_EVENT_SWITCH, 0, 1});
+	pass();
+	SIM_LOG("pressed %d %d %d", agg.pressed(25, 2), agg.pressed(3, 4), agg.pressed(1, 2));
+	sim_report(right, {IK_EVENT_SWITCH, 0, 0});
+	sim_report(right, {IK_EVENT_MEMBRANE_RELEASE, 1, 2});
+	sim_report(left, {IK_EVENT_SWITCH, 0, 0});
+	sim_report(left, {IK_EVENT_MEMBRANE_RELEASE, 3, 4});
+	pass();
+
+	// Overlap: move the right board onto the left one. A cell or switch
+	// is pressed by the first board and released by the last.
+	agg.boards[1].x_offset = 0;
+	agg.boards[1].switch_offset = 0;
+	sim_report(left, {IK_EVENT_MEMBRANE_PRESS, 3, 4});
+	sim_report(right, {IK_EVENT_MEMBRANE_PRESS, 3, 4});
+	sim_report(right, {IK_EVENT_SWITCH, 1, 1});
+	pass();
+	sim_report(left, {IK_EVENT_MEMBRANE_RELEASE, 3, 4});
+	sim_report(left, {IK_EVENT_SWITCH, 1, 1});
+	pass();
+
+	// Unplug the right board while it holds 3,4 and switch 1. Both are
+	// released and the left board's switch 1 is then passed on.
+	right.disconnect();
+	pass();
+	SIM_LOG("pressed %d switches %d", agg.pressed(3, 4), agg.boards[1].switches);
+	sim_report(left, {IK_EVENT_SWITCH, 1, 0});
+	pass();
+	sim_report(left, {IK_EVENT_SWITCH, 1, 1});
+	pass();
+	sim_report(left, {IK_EVENT_SWITCH, 1, 0});
+	pass();
+
+	// A burst larger than the queue is delivered in more than one call
+	agg.onMembranePress(cb_count);
+	agg.onEvents(cb_events_count);
+	for (int i = 0; i < 3 * IK_RESOLUTION_X; i++) {
+		sim_report(left, {IK_EVENT_MEMBRANE_PRESS, (uint8_t)(i % IK_RESOLUTION_X),
+				(uint8_t)(i / IK_RESOLUTION_X)});
+		if (i % 12 == 11) left.Task();
+	}
+	pass();
+	SIM_LOG("presses %d", presses);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/* IntelliKeys calibration cache host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Several boards share one calibration cache. Reconnecting a cached board
+ * is a hit and writes nothing, a new board replaces the entry written
+ * longest ago, two boards finishing together do not share a slot, and
+ * Task() never writes more than one EEPROM byte per pass.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeys ik1(host), ik2(host);
+static SimBoard board1, board2;
+static bool hit;
+static int failed;
+
+static void cb_sn(void *ctx, uint8_t *)
+{
+	IntelliKeys *ik = (IntelliKeys *)ctx;
+	// Reported before the whole IK EEPROM was read, so from the cache
+	hit = !ik->ee->eeprom_all_valid;
+}
+
+static void step(SimBoard &b, uint32_t ms)
+{
+	while (ms--) {
+		uint32_t before = EEPROM.writes;
+		b.step();
+		if (EEPROM.writes - before > 1) {
+			printf("FAIL %u EEPROM writes in one pass\n", EEPROM.writes - before);
+			failed = 1;
+		}
+	}
+}
+
+// Connect a board with serial number tag, return true on a cache hit
+static bool connect(IntelliKeys &ik, SimBoard &b, char tag)
+{
+	b.eeprom[0] = tag;
+	b.eeprom[29] = tag;	// calibration differs per board too
+	hit = false;
+	b.attach(ik);
+	step(b, 300);
+	ik.disconnect();
+	return hit;
+}
+
+static void expect(const char *what, bool got, bool want)
+{
+	if (got == want) return;
+	printf("FAIL %s: got %d\n", what, got);
+	failed = 1;
+}
+
+int main()
+{
+	memset(EEPROM.mem, 0xFF, sizeof(EEPROM.mem));
+	ik1.begin();
+	ik2.begin();
+	ik1.setCalibrationCache(16);
+	ik2.setCalibrationCache(16);
+	ik1.onSerialNum(IKDelegate<uint8_t *>(cb_sn, &ik1));
+	ik2.onSerialNum(IKDelegate<uint8_t *>(cb_sn, &ik2));
+
+	expect("A first", connect(ik1, board1, 'A'), false);
+	expect("B first", connect(ik1, board1, 'B'), false);
+	uint32_t writes = EEPROM.writes;
+	for (int i = 0; i < 3; i++) {
+		expect("A again", connect(ik1, board1, 'A'), true);
+		expect("B again", connect(ik1, board1, 'B'), true);
+	}
+	expect("no rewrites", EEPROM.writes != writes, false);
+
+	// Fill the cache. E replaces A, the oldest entry.
+	connect(ik1, board1, 'C');
+	connect(ik1, board1, 'D');
+	expect("E first", connect(ik1, board1, 'E'), false);
+	expect("B kept", connect(ik1, board1, 'B'), true);
+	expect("A replaced", connect(ik1, board1, 'A'), false);
+
+	// Two new boards finish reading at the same time
+	board1.eeprom[0] = board1.eeprom[29] = 'F';
+	board2.eeprom[0] = board2.eeprom[29] = 'G';
+	board1.attach(ik1);
+	board2.attach(ik2);
+	for (int i = 0; i < 300; i++) {
+		step(board1, 1);
+		step(board2, 1);
+	}
+	ik1.disconnect();
+	ik2.disconnect();
+	expect("F cached", connect(ik1, board1, 'F'), true);
+	expect("G cached", connect(ik2, board2, 'G'), true);
+
+	// Unplugged while writing: the entry is dropped and the cache still works
+	board1.eeprom[0] = board1.eeprom[29] = 'H';
+	board1.attach(ik1);
+	while (IntelliKeysBase::cal_cache_writer != &ik1 && millis() < 100000) step(board1, 1);
+	step(board1, 5);
+	ik1.disconnect();
+	expect("H dropped", connect(ik2, board2, 'H'), false);
+	expect("H cached", connect(ik2, board2, 'H'), true);
+	expect("G kept", connect(ik2, board2, 'G'), true);
+	return failed;
+}
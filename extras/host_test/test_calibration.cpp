@@ -0,0 +1,122 @@
+/* IntelliKeys sensor calibration host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sample both reference cards, write the calibration to the simulated IK
+ * EEPROM and read it back. Covers a clean write, lost writes that the
+ * read back catches and rewrites, and a board that never takes the write.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeys ik(host);
+static SimBoard board;
+static int failed;
+static int last_step, last_ok, results;
+
+static void cb_cal(int step, bool ok)
+{
+	last_step = step;
+	last_ok = ok;
+	results++;
+}
+
+static void expect(const char *what, int got, int want)
+{
+	if (got == want) return;
+	printf("FAIL %s: got %d want %d\n", what, got, want);
+	failed = 1;
+}
+
+// Sample white then black, then write. Returns the number of WRITE reports.
+static int calibrate(uint8_t white, uint8_t black)
+{
+	memset(board.sensor, white, sizeof(board.sensor));
+	expect("white start", ik.calibrateSensors(IK_CAL_WHITE), true);
+	board.step(100);
+	expect("white ok", last_step == IK_CAL_WHITE && last_ok, true);
+	memset(board.sensor, black, sizeof(board.sensor));
+	expect("black start", ik.calibrateSensors(IK_CAL_BLACK), true);
+	board.step(100);
+	expect("black ok", last_step == IK_CAL_BLACK && last_ok, true);
+
+	board.commands.clear();
+	results = 0;
+	expect("write start", ik.calibrationWrite(), true);
+	board.step(1000);
+	expect("one result", results, 1);
+	expect("write step", last_step, IK_CAL_WRITE);
+
+	int writes = 0;
+	for (size_t i = 0; i < board.commands.size(); i++) {
+		unsigned cmd, lo, hi, data;
+		sscanf(board.commands[i].c_str(), "cmd %u %u %u %u", &cmd, &lo, &hi, &data);
+		if (cmd != IK_CMD_EEPROM_WRITE) continue;
+		writes++;
+		// Calibration bytes are at offsets 29 to 34
+		if (hi != 0x1F || lo < 0x80 + 29 || lo > 0x80 + 34) {
+			printf("FAIL write layout: %s\n", board.commands[i].c_str());
+			failed = 1;
+		}
+	}
+	return writes;
+}
+
+int main()
+{
+	ik.begin();
+	ik.onCalibration(cb_cal);
+	board.attach(ik);
+	board.step(400);
+	expect("ready", ik.ready(), true);
+
+	// Clean write: six bytes, read back once
+	expect("writes", calibrate(220, 20), 6);
+	expect("ok", last_ok, true);
+	expect("black in IK", board.eeprom[29], 20);
+	expect("white in IK", board.eeprom[34], 220);
+	expect("driver copy", ik.ee->eeprom_data.sensorWhite[1], 220);
+
+	// Two writes lost, caught by the read back and written again
+	board.drop_writes = 2;
+	expect("retry writes", calibrate(210, 30), 8);
+	expect("retry ok", last_ok, true);
+	for (int i = 0; i < 3; i++) {
+		expect("retry black", board.eeprom[29 + i], 30);
+		expect("retry white", board.eeprom[32 + i], 210);
+	}
+
+	// The IK never takes the write: fail after IK_CAL_RETRIES rounds
+	board.drop_writes = 1000;
+	calibrate(200, 40);
+	expect("gives up", last_ok, false);
+	expect("IK unchanged", board.eeprom[29], 30);
+	board.drop_writes = 0;
+
+	// Sensors still report after the failed write
+	board.sensor[0] = 200;
+	expect("sensors", ik.request(IK_REQUEST_SENSORS) >= 0, true);
+	board.step(100);
+	return failed;
+}
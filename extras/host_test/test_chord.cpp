@@ -0,0 +1,97 @@
+/* IntelliKeys chord host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Chords on regions past 63 and on switches, and a prefix chord.
+
+#include "sim.h"
+#include "ik_chord.h"
+
+static IKChords chords;
+static std::vector<int> fired;
+
+static void cb_chord(int id) { fired.push_back(id); }
+
+static int check(const char *what, std::initializer_list<int> want)
+{
+	std::vector<int> w(want);
+	if (fired == w) {
+		fired.clear();
+		return 0;
+	}
+	printf("FAIL %s:", what);
+	for (size_t i = 0; i < fired.size(); i++) printf(" %d", fired[i]);
+	printf("\n");
+	fired.clear();
+	return 1;
+}
+
+int main()
+{
+	int failed = 0;
+
+	chords.add(IK_CHORD_REGION(73) | IK_CHORD_REGION(74), 1);
+	chords.add(IK_CHORD_REGION(90) | IK_CHORD_REGION(127), 2);
+	chords.add(IK_CHORD_REGION(90) | IK_CHORD_REGION(127) | IK_CHORD_SWITCH(1), 3);
+	chords.add(IK_CHORD_REGION(5) | IK_CHORD_SWITCH(7), 4);
+	chords.compile();
+	chords.onChord(cb_chord);
+
+	chords.pressRegion(73, 0);
+	chords.pressRegion(74, 10);
+	chords.releaseRegion(73);
+	chords.releaseRegion(74);
+	failed |= check("two regions", {1});
+
+	// 2 is a prefix of 3 so it waits for the window
+	chords.pressRegion(90, 100);
+	chords.pressRegion(127, 110);
+	chords.task(140);
+	failed |= check("prefix early", {});
+	chords.task(150);
+	failed |= check("prefix window", {2});
+	chords.releaseRegion(90);
+	chords.releaseRegion(127);
+
+	chords.pressRegion(127, 200);
+	chords.pressSwitch(1, 205);
+	chords.pressRegion(90, 210);
+	failed |= check("three inputs", {3});
+	chords.releaseRegion(90);
+	chords.releaseRegion(127);
+	chords.releaseSwitch(1);
+
+	chords.pressSwitch(7, 300);
+	chords.pressRegion(5, 400);
+	chords.task(500);
+	failed |= check("outside window", {});
+	chords.releaseSwitch(7);
+	chords.releaseRegion(5);
+
+	// Region 73 alone is not a chord, and 128 is out of range
+	chords.pressRegion(73, 600);
+	chords.pressRegion(IK_REGIONMAP_MAX, 600);
+	chords.task(700);
+	chords.releaseRegion(73);
+	failed |= check("single", {});
+	return failed;
+}
@@ -0,0 +1,150 @@
+/* IntelliKeys driver host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Connect, start up, input, debounce, repeat, requests and calibration
+ * against the simulated board. The log is compared with test_driver.expected.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeys ik(host);
+static SimBoard board;
+
+static void cb_press(int x, int y) { SIM_LOG("press %d %d", x, y); }
+static void cb_release(int x, int y) { SIM_LOG("release %d %d", x, y); }
+static void cb_switch(int n, int s) { SIM_LOG("switch %d %d", n, s); }
+static void cb_sensor(int n, int s) { SIM_LOG("sensor %d %d", n, s); }
+static void cb_version(int a, int b) { SIM_LOG("version %d.%d", a, b); }
+static void cb_connect(void) { SIM_LOG("connect"); }
+static void cb_disconnect(void) { SIM_LOG("disconnect"); }
+static void cb_ready(void) { SIM_LOG("ready"); }
+static void cb_sn(uint8_t *sn) { SIM_LOG("sn %.29s", (char *)sn); }
+static void cb_overlay(int id) { SIM_LOG("overlay %d", id); }
+static void cb_cal(int s, bool ok) { SIM_LOG("cal %d %d", s, ok); }
+static void cb_correct(int x, int y) { SIM_LOG("correct %d %d", x, y); }
+static void cb_correct_done(void) { SIM_LOG("correct done"); }
+static void cb_repeat(int id) { SIM_LOG("repeat %d", id); }
+static void cb_req(void *ctx, ik_request_t, int st) { SIM_LOG("request %s %d", (const char *)ctx, st); }
+static void cb_events(const ik_event_t *e, size_t n)
+{
+	printf("%5u events", millis());
+	for (size_t i = 0; i < n; i++) printf(" [%u %d %d %d]", e[i].time, e[i].type, e[i].x, e[i].y);
+	printf("\n");
+}
+
+int main()
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	board.held[5][6] = true;
+	board.sensor[1] = 45;
+	ik.begin();
+	ik.onMembranePress(cb_press);
+	ik.onMembraneRelease(cb_release);
+	ik.onSwitch(cb_switch);
+	ik.onSensor(cb_sensor);
+	ik.onVersion(cb_version);
+	ik.onConnect(cb_connect);
+	ik.onDisconnect(cb_disconnect);
+	ik.onReady(cb_ready);
+	ik.onSerialNum(cb_sn);
+	ik.onOverlayChange(cb_overlay);
+	ik.onCalibration(cb_cal);
+	ik.onRepeat(cb_repeat);
+	ik.onEvents(cb_events);
+	ik.onCorrectMembrane(cb_correct);
+	ik.onCorrectDone(cb_correct_done);
+
+	board.attach(ik);
+	board.step(400);
+	SIM_LOG("ready=%d time=%u eeprom=%u", ik.ready(), ik.readyTime(), ik.eepromReadTime());
+
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 1, 2});
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 1, 3});
+	sim_report(ik, {IK_EVENT_SWITCH, 1, 1});
+	board.step();
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 1, 2});
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 1, 3});
+	sim_report(ik, {IK_EVENT_SWITCH, 1, 0});
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 5, 6});
+	board.step();
+	SIM_LOG("count=%d", ik.membraneCount());
+
+	ik.setDebounce(5, 5);
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 7, 7});
+	board.step(2);
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 7, 7});
+	board.step();
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 8, 8});
+	board.step(10);
+	sim_report(ik, {IK_EVENT_MEMBRANE_RELEASE, 8, 8});
+	board.step(10);
+	ik.setDebounce(0, 0);
+
+	ik.repeatStart(9, 0, 1);
+	sim_us += 2000;
+	ik.repeat_timer();
+	board.step();
+	ik.repeatStop(9);
+
+	board.sensor[1] = 190;
+	SIM_LOG("req %d", ik.request(IK_REQUEST_SENSORS, IKDelegate<ik_request_t, int>(cb_req, (void *)"sensors")) >= 0);
+	SIM_LOG("req %d", ik.request(IK_REQUEST_VERSION, IKDelegate<ik_request_t, int>(cb_req, (void *)"version")) >= 0);
+	board.step(400);
+	SIM_LOG("overlay=%d", ik.getOverlay());
+
+	memset(board.sensor, 210, sizeof(board.sensor));
+	SIM_LOG("cal %d", ik.calibrateSensors(IK_CAL_WHITE));
+	board.step(50);
+	memset(board.sensor, 30, sizeof(board.sensor));
+	SIM_LOG("cal %d", ik.calibrateSensors(IK_CAL_BLACK));
+	board.step(50);
+	SIM_LOG("write %d", ik.calibrationWrite());
+	board.step(300);
+	SIM_LOG("ee %d %d %d %d %d %d", board.eeprom[29], board.eeprom[30], board.eeprom[31],
+			board.eeprom[32], board.eeprom[33], board.eeprom[34]);
+
+	// Only the sketch's own get_correct reaches onCorrect...
+	board.held[2][3] = true;
+	ik.resync();
+	board.step(10);
+	ik.get_correct();
+	board.step(10);
+
+	ik_request_t h = ik.request(IK_REQUEST_VERSION, IKDelegate<ik_request_t, int>(cb_req, (void *)"lost"), 20, 1);
+	board.tx.clear();
+	board.step(100);
+	SIM_LOG("status %d", ik.requestStatus(h));
+
+	ik.disconnect();
+	for (size_t i = 0; i < board.commands.size(); i++) printf("%s\n", board.commands[i].c_str());
+
+	// onVersion fires again on the next connect, and only once
+	board.attach(ik);
+	board.step(400);
+	ik.get_version();
+	board.step(10);
+	ik.disconnect();
+	return 0;
+}
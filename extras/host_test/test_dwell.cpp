@@ -0,0 +1,108 @@
+/* IntelliKeys dwell host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Accept delay, cancelled presses, a queue full of cancelled presses and
+// changing the delay.
+
+#include "sim.h"
+#include "ik_dwell.h"
+
+static IKDwell dwell;
+static std::string log_text;
+
+static void cb_activate(int region) { log_text += " +" + std::to_string(region); }
+static void cb_deactivate(int region) { log_text += " -" + std::to_string(region); }
+
+static int check(const char *what, const char *want)
+{
+	int failed = log_text != want;
+	if (failed) printf("FAIL %s: got '%s' want '%s'\n", what, log_text.c_str(), want);
+	log_text.clear();
+	return failed;
+}
+
+int main()
+{
+	int failed = 0;
+
+	dwell.onActivate(cb_activate);
+	dwell.onDeactivate(cb_deactivate);
+	dwell.setDwell(100);
+
+	dwell.press(5, 0);
+	dwell.press(100, 10);
+	dwell.task(99);
+	failed |= check("early", "");
+	dwell.task(100);
+	failed |= check("first", " +5");
+	dwell.release(5);
+	dwell.task(110);
+	failed |= check("second", " -5 +100");
+
+	// Released before the delay, pressed again: only the new press counts
+	dwell.press(7, 200);
+	dwell.release(7);
+	dwell.press(7, 250);
+	dwell.task(300);
+	failed |= check("cancel", "");
+	dwell.task(350);
+	failed |= check("again", " +7");
+
+	// Changing the delay keeps held regions
+	dwell.setDwell(20);
+	dwell.release(7);
+	dwell.release(100);
+	failed |= check("set keeps", " -7 -100");
+
+	// The timestamps wrap at 16 bits
+	dwell.press(9, 65530);
+	dwell.task(65545);
+	failed |= check("wrap early", "");
+	dwell.task(65550);
+	failed |= check("wrap", " +9");
+	dwell.release(9);
+	log_text.clear();
+
+	// Cancelled presses fill the queue. Later presses still wait the
+	// whole delay and earlier live presses keep their place.
+	dwell.setDwell(1000);
+	dwell.press(3, 70000);
+	for (int i = 0; i < 4 * IK_REGIONMAP_MAX; i++) {
+		dwell.press(1, 70000 + i);
+		dwell.release(1);
+	}
+	dwell.press(2, 71100);
+	failed |= check("full", "");
+	dwell.task(70999);
+	failed |= check("full early", "");
+	dwell.task(71000);
+	failed |= check("full live", " +3");
+	dwell.task(72099);
+	failed |= check("full wait", "");
+	dwell.task(72100);
+	failed |= check("full late", " +2");
+	dwell.task(80000);
+	failed |= check("full cancelled", "");
+	dwell.reset();
+	return failed;
+}
@@ -0,0 +1,60 @@
+/* IntelliKeys fast path host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * onMembraneISR and onMembranePress see the same reports, also when the
+ * receive ring overruns and a report is dropped.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeysT<IK_FEATURE_MEMBRANE> ik(host);
+static SimBoard board;
+static int isr_presses, presses;
+
+static void cb_isr(int, int, int state) { if (state) isr_presses++; }
+static void cb_press(int, int) { presses++; }
+
+int main()
+{
+	int failed = 0;
+
+	ik.onMembraneISR(cb_isr);
+	ik.onMembranePress(cb_press);
+	board.attach(ik);
+	board.step(400);
+
+	// The ring holds IK_RX_RING_SIZE - 1 reports, the last one is dropped
+	for (int i = 0; i < IK_RX_RING_SIZE; i++) {
+		sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, (uint8_t)i, 0});
+	}
+	board.step();
+	if (ik.irq_stats.rx_overruns != 1 || isr_presses != IK_RX_RING_SIZE - 1 ||
+			presses != isr_presses) {
+		printf("FAIL overruns %u isr %d press %d\n",
+				ik.irq_stats.rx_overruns, isr_presses, presses);
+		failed = 1;
+	}
+	return failed;
+}
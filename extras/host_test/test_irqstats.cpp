@@ -0,0 +1,71 @@
+/* IntelliKeys interrupt statistics host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * getIrqStats() counts every entry point USBHost_t36 calls from its
+ * interrupt, and in the IK_IRQ_BASELINE build also the masked requeue.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeysT<IK_FEATURE_MEMBRANE> ik(host);
+static SimBoard board;
+static int failed;
+
+static void expect(const char *what, uint32_t count)
+{
+	ik_irq_stats_t stats;
+	ik.getIrqStats(&stats);
+	if (stats.count != count) {
+		printf("FAIL %s count %u expected %u\n", what, stats.count, count);
+		failed = 1;
+	}
+	ik.clearIrqStats();
+}
+
+int main()
+{
+	ik.clearIrqStats();
+	board.attach(ik);
+	expect("claim", 1);
+	board.step(400);
+
+	ik.clearIrqStats();
+	ik.setLED(1, 1);
+	board.step();
+	expect("tx_data", 1);
+
+	sim_report(ik, {IK_EVENT_MEMBRANE_PRESS, 1, 1});
+	expect("rx_data", 1);
+	board.step();
+	expect("Task", IK_IRQ_BASELINE ? 1 : 0);
+
+	Transfer_t t = {};
+	ik.control(&t);
+	expect("control", 1);
+
+	ik.disconnect();
+	expect("disconnect", 1);
+	return failed;
+}
@@ -0,0 +1,107 @@
+/* IntelliKeys pointer host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Edge and corner cells reach the ends of the output range.
+
+#include "sim.h"
+#include "ik_pointer.h"
+
+static IKPointer pointer;
+static int last_x, last_y;
+
+static void cb_move(int x, int y) { last_x = x; last_y = y; }
+
+static int touch(uint8_t id, int cx, int cy, int want_x, int want_y)
+{
+	ik_contact_t c = {};
+	c.id = id;
+	c.x = cx * IK_CONTACT_SCALE + IK_CONTACT_SCALE / 2;
+	c.y = cy * IK_CONTACT_SCALE + IK_CONTACT_SCALE / 2;
+	pointer.contact(c, IK_CONTACT_DOWN);
+	pointer.contact(c, IK_CONTACT_UP);
+	if (last_x == want_x && last_y == want_y) return 0;
+	printf("FAIL cell %d,%d: got %d,%d want %d,%d\n", cx, cy, last_x, last_y, want_x, want_y);
+	return 1;
+}
+
+int main()
+{
+	int failed = 0;
+
+	pointer.setOutput(1920, 1080);
+	pointer.onMove(cb_move);
+	failed |= touch(1, 0, 0, 0, 0);
+	failed |= touch(2, 23, 23, 1919, 1079);
+	failed |= touch(3, 0, 23, 0, 1079);
+	failed |= touch(4, 23, 0, 1919, 0);
+
+	// Sub-area, cells outside are ignored
+	pointer.setArea(4, 4, 8, 8);
+	failed |= touch(5, 4, 11, 0, 1079);
+	failed |= touch(6, 11, 4, 1919, 0);
+	last_x = last_y = -1;
+	failed |= touch(7, 12, 4, -1, -1);
+
+	// reset() lets a new contact take over
+	ik_contact_t c = {};
+	c.id = 8;
+	c.x = c.y = 6 * IK_CONTACT_SCALE;
+	pointer.contact(c, IK_CONTACT_DOWN);
+	pointer.reset();
+	failed |= pointer.touching();
+	failed |= touch(9, 11, 11, 1919, 1079);
+
+	// A drag lags behind while smoothing, then task() brings the pointer
+	// to where the finger stopped
+	pointer.setArea(0, 0, IK_RESOLUTION_X, IK_RESOLUTION_Y);
+	c.id = 10;
+	c.x = c.y = IK_CONTACT_SCALE / 2;
+	pointer.contact(c, IK_CONTACT_DOWN);
+	for (int i = 1; i < IK_RESOLUTION_X; i++) {
+		c.x = i * IK_CONTACT_SCALE + IK_CONTACT_SCALE / 2;
+		pointer.contact(c, IK_CONTACT_MOVE);
+	}
+	if (last_x == 1919) {
+		printf("FAIL drag not smoothed\n");
+		failed = 1;
+	}
+	for (uint32_t now = 0; now < 1000; now += IK_POINTER_STEP_MS) pointer.task(now);
+	if (last_x != 1919 || last_y != 0) {
+		printf("FAIL drag end: got %d,%d want 1919,0\n", last_x, last_y);
+		failed = 1;
+	}
+	// Lifting mid-drag still settles on the last position
+	pointer.contact(c, IK_CONTACT_UP);
+	c.id = 11;
+	c.x = c.y = IK_CONTACT_SCALE / 2;
+	pointer.contact(c, IK_CONTACT_DOWN);
+	c.y = 12 * IK_CONTACT_SCALE + IK_CONTACT_SCALE / 2;
+	pointer.contact(c, IK_CONTACT_MOVE);
+	pointer.contact(c, IK_CONTACT_UP);
+	for (uint32_t now = 1000; now < 2000; now += IK_POINTER_STEP_MS) pointer.task(now);
+	if (last_x != 0 || last_y != 12 * 1079 / 23) {
+		printf("FAIL lift: got %d,%d want 0,%d\n", last_x, last_y, 12 * 1079 / 23);
+		failed = 1;
+	}
+	return failed;
+}
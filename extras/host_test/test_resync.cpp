@@ -0,0 +1,139 @@
+/* IntelliKeys resync feature host test
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A cell held when the IK connects is only reported by the driver built
+ * with IK_FEATURE_RESYNC. The driver without it never sends CORRECT and
+ * its get_correct() does nothing. A resync that overlaps the reply to
+ * get_correct() neither releases held cells nor splits the reply, and
+ * IK_REQUEST_CORRECT waits for a resync already in flight.
+ */
+
+#include "sim.h"
+
+static USBHost host;
+static IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_RESYNC |
+	IK_FEATURE_REQUESTS> with(host);
+static IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH> without(host);
+static SimBoard board_with, board_without;
+static int presses_with, presses_without, corrects, releases, dones;
+static int failed;
+
+static void cb_press_with(int, int) { presses_with++; }
+static void cb_press_without(int, int) { presses_without++; }
+static void cb_correct(int, int) { corrects++; }
+static void cb_release(int, int) { releases++; }
+static void cb_done(void) { dones++; }
+static int request_status = -1;
+static void cb_request(void *, ik_request_t, int status) { request_status = status; }
+
+static void expect(const char *what, int got, int want)
+{
+	if (got == want) return;
+	printf("FAIL %s: got %d want %d\n", what, got, want);
+	failed = 1;
+}
+
+static int correct_commands(SimBoard &board)
+{
+	int n = 0;
+	for (size_t i = 0; i < board.commands.size(); i++) {
+		unsigned cmd;
+		sscanf(board.commands[i].c_str(), "cmd %u", &cmd);
+		if (cmd == IK_CMD_CORRECT) n++;
+	}
+	return n;
+}
+
+int main()
+{
+	board_with.held[3][4] = true;
+	board_without.held[3][4] = true;
+	with.begin();
+	without.begin();
+	with.onMembranePress(cb_press_with);
+	with.onCorrectMembrane(cb_correct);
+	without.onMembranePress(cb_press_without);
+	without.onCorrectMembrane(cb_correct);
+	board_with.attach(with);
+	board_without.attach(without);
+	board_with.step(400);
+	board_without.step(400);
+
+	expect("features", without.getFeatures() & IK_FEATURE_RESYNC, 0);
+	expect("ready with", with.ready(), true);
+	expect("ready without", without.ready(), true);
+	expect("held reported", presses_with, 1);
+	expect("held not reported", presses_without, 0);
+	expect("resync sent", correct_commands(board_with) > 0, true);
+	expect("no resync sent", correct_commands(board_without), 0);
+
+	// get_correct() reports to onCorrectMembrane only with the feature
+	expect("get_correct without", without.get_correct(), 0);
+	sim_report(without, {IK_EVENT_CORRECT_MEMBRANE, 3, 4});
+	sim_report(without, {IK_EVENT_CORRECT_DONE});
+	board_without.step(10);
+	expect("ignored", corrects, 0);
+	with.get_correct();
+	board_with.step(10);
+	expect("reported", corrects, 1);
+	expect("no extra press", presses_with, 1);
+
+	// Ten cells take three ms to report. A resync sent partway through
+	// must wait for its own reply instead of applying half of this one.
+	for (int x = 10; x < 20; x++) {
+		board_with.held[x][0] = true;
+		sim_report(with, {IK_EVENT_MEMBRANE_PRESS, (uint8_t)x, 0});
+	}
+	with.onMembraneRelease(cb_release);
+	with.onCorrectDone(cb_done);
+	board_with.step(10);
+	expect("new cells", presses_with, 11);
+	corrects = 0;
+	with.get_correct();
+	board_with.step(2);
+	with.resync();
+	board_with.step(1);
+	// Already waiting, this one is not sent
+	with.resync();
+	board_with.step(20);
+	expect("no release", releases, 0);
+	expect("no press", presses_with, 11);
+	expect("one reply", corrects, 11);
+	expect("one done", dones, 1);
+	expect("settled", with.rs->correct_sent, 0);
+	expect("two sent", correct_commands(board_with), 4);
+	expect("idle", with.rs->resync_active, false);
+
+	// A request while a resync waits for its reply is completed by that
+	// reply, even when the reply is slower than the request timeout
+	with.resync();
+	ik_request_t h = with.request(IK_REQUEST_CORRECT,
+			IKDelegate<ik_request_t, int>(cb_request, NULL), 1, 3);
+	expect("handle", h >= 0, true);
+	board_with.step(20);
+	expect("request done", request_status, IK_REQUEST_DONE);
+	expect("no release after", releases, 0);
+	expect("one more sent", correct_commands(board_with), 5);
+	return failed;
+}
@@ -0,0 +1,205 @@
+/* IntelliKeys multi-board aggregator
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <Arduino.h>
+#include "USBHost_t36.h"
+#include "ik_aggregate.h"
+
+IKAggregator::IKAggregator()
+{
+	nboards = 0;
+	queued = 0;
+}
+
+int IKAggregator::add(IntelliKeysBase &board, uint8_t x_offset, uint8_t y_offset,
+		uint8_t switch_offset)
+{
+	if (nboards >= IK_AGGREGATE_MAX) return -1;
+	if (!(board.getFeatures() & IK_FEATURE_EVENTS)) return -1;
+	board_t &b = boards[nboards];
+	b.owner = this;
+	b.ik = &board;
+	b.x_offset = x_offset;
+	b.y_offset = y_offset;
+	b.switch_offset = switch_offset;
+	b.down.clear();
+	b.switches = 0;
+	board.onEvents(IKDelegate<const ik_event_t *, size_t>(board_events, &b));
+	return nboards++;
+}
+
+// One board's events from myusb.Task(), queued until task()
+void IKAggregator::board_events(void *context, const ik_event_t *events, size_t count)
+{
+	board_t *b = (board_t *)context;
+	IKAggregator *agg = b->owner;
+
+	for (size_t i = 0; i < count; i++) {
+		if (agg->queued >= IK_AGGREGATE_QUEUE) agg->deliver();
+		ik_board_event_t &e = agg->queue[agg->queued++];
+		e.time = events[i].time;
+		e.type = events[i].type;
+		e.x = events[i].x;
+		e.y = events[i].y;
+		e.board = b - agg->boards;
+		switch (e.type) {
+			case IK_EVENT_MEMBRANE_PRESS:
+			case IK_EVENT_MEMBRANE_RELEASE:
+			case IK_EVENT_MEMBRANE_REPEAT:
+				e.x += b->x_offset;
+				e.y += b->y_offset;
+				break;
+			case IK_EVENT_SWITCH:
+			case IK_EVENT_SWITCH_REPEAT:
+				e.x += b->switch_offset;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+void IKAggregator::task(void)
+{
+	deliver();
+	for (int i = 0; i < nboards; i++) release_lost(i);
+	deliver();
+}
+
+void IKAggregator::deliver(void)
+{
+	size_t count = 0;
+
+	// Each board's events are already in order so the insertion sort has
+	// little to do. Equal times keep the order they were queued in.
+	for (int i = 1; i < queued; i++) {
+		ik_board_event_t e = queue[i];
+		int j = i;
+		while (j > 0 && (int32_t)(queue[j-1].time - e.time) > 0) {
+			queue[j] = queue[j-1];
+			j--;
+		}
+		queue[j] = e;
+	}
+	for (int i = 0; i < queued; i++) {
+		if (merge(queue[i])) queue[count++] = queue[i];
+	}
+	queued = 0;
+	if (count && events_callback) events_callback(queue, count);
+}
+
+// Returns false if another board holds the same cell or switch, so the
+// event changes nothing on the merged surface.
+bool IKAggregator::merge(ik_board_event_t &e)
+{
+	board_t &b = boards[e.board];
+	int x = e.x - b.x_offset;
+	int y = e.y - b.y_offset;
+	int n = e.x - b.switch_offset;
+
+	switch (e.type) {
+		case IK_EVENT_MEMBRANE_PRESS:
+			if (IKBitmap::valid(x, y)) b.down.set(x, y);
+			if (held(e.x, e.y, e.board)) return false;
+			if (press_callback) press_callback(e.x, e.y);
+			break;
+		case IK_EVENT_MEMBRANE_RELEASE:
+			if (IKBitmap::valid(x, y)) b.down.reset(x, y);
+			if (held(e.x, e.y, e.board)) return false;
+			if (release_callback) release_callback(e.x, e.y);
+			break;
+		case IK_EVENT_SWITCH:
+			if (n >= 0 && n < 16) {
+				if (e.y) {
+					b.switches |= (1 << n);
+				} else {
+					b.switches &= ~(1 << n);
+				}
+			}
+			if (switch_held(e.x, e.board)) return false;
+			if (switch_callback) switch_callback(e.x, e.y);
+			break;
+		default:
+			break;
+	}
+	return true;
+}
+
+// Release the cells and switches a board still holds here but its driver
+// does not, for example after the board was unplugged.
+void IKAggregator::release_lost(int board)
+{
+	board_t &b = boards[board];
+	IKBitmap now, released;
+	uint16_t lost = b.switches & ~b.ik->switchState();
+
+	while (lost) {
+		int n = __builtin_ctz(lost);
+		lost &= lost - 1;
+		if (queued >= IK_AGGREGATE_QUEUE) deliver();
+		ik_board_event_t &e = queue[queued++];
+		e.time = millis();
+		e.type = IK_EVENT_SWITCH;
+		e.x = n + b.switch_offset;
+		e.y = 0;
+		e.board = board;
+	}
+	b.ik->membraneSnapshot(&now);
+	if (!IKBitmap::diff(b.down, now, NULL, &released)) return;
+	for (int y = 0; y < IK_RESOLUTION_Y; y++) {
+		uint32_t bits = released.row_bits(y);
+		while (bits) {
+			int x = __builtin_ctz(bits);
+			bits &= bits - 1;
+			if (queued >= IK_AGGREGATE_QUEUE) deliver();
+			ik_board_event_t &e = queue[queued++];
+			e.time = millis();
+			e.type = IK_EVENT_MEMBRANE_RELEASE;
+			e.x = x + b.x_offset;
+			e.y = y + b.y_offset;
+			e.board = board;
+		}
+	}
+}
+
+// Is merged cell x,y held by any board other than skip
+bool IKAggregator::held(int x, int y, int skip) const
+{
+	for (int i = 0; i < nboards; i++) {
+		const board_t &b = boards[i];
+		int bx = x - b.x_offset;
+		int by = y - b.y_offset;
+		if (i != skip && IKBitmap::valid(bx, by) && b.down.test(bx, by)) return true;
+	}
+	return false;
+}
+
+bool IKAggregator::switch_held(int number, int skip) const
+{
+	for (int i = 0; i < nboards; i++) {
+		int n = number - boards[i].switch_offset;
+		if (i != skip && n >= 0 && n < 16 && (boards[i].switches & (1 << n))) return true;
+	}
+	return false;
+}
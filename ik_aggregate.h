@@ -0,0 +1,124 @@
+/* IntelliKeys multi-board aggregator
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_AGGREGATE_H_
+#define _IK_AGGREGATE_H_
+
+#include "intellikeys.h"
+
+// Boards per aggregator
+#ifndef IK_AGGREGATE_MAX
+#define IK_AGGREGATE_MAX 4
+#endif
+
+// Events held until task(). A fuller queue is delivered early.
+#ifndef IK_AGGREGATE_QUEUE
+#define IK_AGGREGATE_QUEUE 64
+#endif
+
+// Event from one board with its membrane coordinates and switch numbers
+// moved by the board offsets
+typedef struct {
+	uint32_t time;	// millis() when the report arrived
+	uint8_t type;	// IK_EVENT_MEMBRANE_PRESS, IK_EVENT_SWITCH, ...
+	uint8_t x;	// or switch or sensor number, or On/Off state
+	uint8_t y;	// or switch or sensor state
+	uint8_t board;	// number returned by add()
+} ik_board_event_t;
+
+/*
+ * Several boards as one input surface. Each board is added with offsets for
+ * its membrane coordinates and switch numbers, so boards at x offsets 0 and
+ * 24 make one 48x24 surface and boards with the same offsets act as one
+ * board. task() hands on the events of every board in the order their
+ * reports arrived, whichever board the USB host serviced first. Where
+ * boards overlap, a cell or switch is pressed by the first board to press
+ * it and released by the last one to let go. Cells and switches still held
+ * by a board that disconnects are released.
+ */
+class IKAggregator {
+public:
+	IKAggregator();
+	// Returns the board number, or -1 if IK_AGGREGATE_MAX boards have been
+	// added or the board was built without IK_FEATURE_EVENTS. The
+	// aggregator takes over the board's onEvents.
+	int add(IntelliKeysBase &board, uint8_t x_offset, uint8_t y_offset,
+			uint8_t switch_offset = 0);
+	// Call from loop() after myusb.Task()
+	void task(void);
+	// Merged cell state
+	bool pressed(int x, int y) const { return held(x, y, -1); }
+	void onMembranePress(void (*function)(int x, int y)) {
+		press_callback = function;
+	}
+	void onMembranePress(const IKDelegate<int, int> &delegate) {
+		press_callback = delegate;
+	}
+	void onMembraneRelease(void (*function)(int x, int y)) {
+		release_callback = function;
+	}
+	void onMembraneRelease(const IKDelegate<int, int> &delegate) {
+		release_callback = delegate;
+	}
+	void onSwitch(void (*function)(int switch_number, int switch_state)) {
+		switch_callback = function;
+	}
+	void onSwitch(const IKDelegate<int, int> &delegate) {
+		switch_callback = delegate;
+	}
+	// All events of one task() call from every board, after the per-event
+	// callbacks. Build one combined HID report here.
+	void onEvents(void (*function)(const ik_board_event_t *events, size_t count)) {
+		events_callback = function;
+	}
+	void onEvents(const IKDelegate<const ik_board_event_t *, size_t> &delegate) {
+		events_callback = delegate;
+	}
+private:
+	typedef struct {
+		IKAggregator *owner;
+		IntelliKeysBase *ik;
+		uint8_t x_offset;
+		uint8_t y_offset;
+		uint8_t switch_offset;
+		IKBitmap down;		// cells this board holds, board coordinates
+		uint16_t switches;
+	} board_t;
+	static void board_events(void *context, const ik_event_t *events, size_t count);
+	void deliver(void);
+	bool merge(ik_board_event_t &e);
+	void release_lost(int board);
+	bool held(int x, int y, int skip) const;
+	bool switch_held(int number, int skip) const;
+	board_t boards[IK_AGGREGATE_MAX];
+	uint8_t nboards;
+	ik_board_event_t queue[IK_AGGREGATE_QUEUE];
+	uint16_t queued;
+	IKDelegate<int, int> press_callback;
+	IKDelegate<int, int> release_callback;
+	IKDelegate<int, int> switch_callback;
+	IKDelegate<const ik_board_event_t *, size_t> events_callback;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/* IntelliKeys membrane bitmap
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _IK_BITMAP_H_
+#define _IK_BITMAP_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "intellikeysdefs.h"
+
+#define IK_MEMBRANE_CELLS (IK_RESOLUTION_X*IK_RESOLUTION_Y)
+#define IK_MEMBRANE_WORDS ((IK_MEMBRANE_CELLS+31)/32)
+
+/*
+ * One bit per membrane cell, 576 bits = 72 bytes. Cell (x,y) is bit
+ * y*IK_RESOLUTION_X + x. Each row is 24 bits so a row may straddle two
+ * words.
+ */
+class IKBitmap {
+public:
+	uint32_t words[IK_MEMBRANE_WORDS];
+
+	IKBitmap() { clear(); }
+	void clear(void) { memset(words, 0, sizeof(words)); }
+	static bool valid(int x, int y) {
+		return (x >= 0) && (x < IK_RESOLUTION_X) && (y >= 0) && (y < IK_RESOLUTION_Y);
+	}
+	static int cell(int x, int y) { return (y * IK_RESOLUTION_X) + x; }
+	void set(int x, int y) {
+		int c = cell(x, y);
+		words[c >> 5] |= (1UL << (c & 31));
+	}
+	void reset(int x, int y) {
+		int c = cell(x, y);
+		words[c >> 5] &= ~(1UL << (c & 31));
+	}
+	bool test(int x, int y) const {
+		int c = cell(x, y);
+		return (words[c >> 5] >> (c & 31)) & 1;
+	}
+	bool empty(void) const {
+		for (int i = 0; i < IK_MEMBRANE_WORDS; i++) {
+			if (words[i]) return false;
+		}
+		return true;
+	}
+	// Number of cells set
+	int count(void) const {
+		int n = 0;
+		for (int i = 0; i < IK_MEMBRANE_WORDS; i++) {
+			n += __builtin_popcount(words[i]);
+		}
+		return n;
+	}
+	// Number of cells set in the rectangle at (x,y) of width by height cells
+	int count(int x, int y, int width, int height) const {
+		if (x < 0) { width += x; x = 0; }
+		if (y < 0) { height += y; y = 0; }
+		if (x + width > IK_RESOLUTION_X) width = IK_RESOLUTION_X - x;
+		if (y + height > IK_RESOLUTION_Y) height = IK_RESOLUTION_Y - y;
+		if (width <= 0 || height <= 0) return 0;
+		uint32_t mask = ((1UL << width) - 1) << x;
+		int n = 0;
+		for (int row = y; row < y + height; row++) {
+			n += __builtin_popcount(row_bits(row) & mask);
+		}
+		return n;
+	}
+	// Bits 0..IK_RESOLUTION_X-1 of the result are cells (0,y)..(23,y)
+	uint32_t row_bits(int y) const {
+		int bit = y * IK_RESOLUTION_X;
+		int w = bit >> 5;
+		int shift = bit & 31;
+		uint32_t v = words[w] >> shift;
+		if (shift > 32 - IK_RESOLUTION_X) v |= words[w + 1] << (32 - shift);
+		return v & ((1UL << IK_RESOLUTION_X) - 1);
+	}
+	/*
+	 * Compare two bitmaps. Cells set in to but not in from are returned in
+	 * pressed, cells set in from but not in to are returned in released.
+	 * Either may be NULL. Returns the number of cells that changed.
+	 */
+	static int diff(const IKBitmap &from, const IKBitmap &to,
+			IKBitmap *pressed, IKBitmap *released) {
+		int n = 0;
+		for (int i = 0; i < IK_MEMBRANE_WORDS; i++) {
+			uint32_t changed = from.words[i] ^ to.words[i];
+			if (pressed) pressed->words[i] = changed & to.words[i];
+			if (released) released->words[i] = changed & from.words[i];
+			n += __builtin_popcount(changed);
+		}
+		return n;
+	}
+};
+
+#endif
@@ -0,0 +1,142 @@
+/* IntelliKeys chord recognizer
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_chord.h"
+
+void IKChords::clear(void)
+{
+	nchords = 0;
+	memset(table, 0, sizeof(table));
+	window = 50;
+	chord_callback = NULL;
+	reset();
+}
+
+void IKChords::reset(void)
+{
+	held.clear();
+	gathered.clear();
+	window_open = false;
+	fired = false;
+}
+
+bool IKChords::add(const IKChordMask &mask, uint8_t id)
+{
+	if (mask.empty() || nchords >= IK_CHORD_MAX) return false;
+	chords[nchords].mask = mask;
+	chords[nchords].id = id;
+	chords[nchords].prefix = false;
+	nchords++;
+	return true;
+}
+
+uint32_t IKChords::hash(const IKChordMask &mask)
+{
+	uint32_t h = 0;
+	for (int i = 0; i < IK_CHORD_WORDS; i++) {
+		h = (h ^ mask.words[i]) * 0x9E3779B1UL;
+	}
+	return h >> (32 - IK_CHORD_HASH_BITS);
+}
+
+void IKChords::compile(void)
+{
+	const uint32_t size = 1 << IK_CHORD_HASH_BITS;
+
+	memset(table, 0, sizeof(table));
+	for (uint8_t i = 0; i < nchords; i++) {
+		chords[i].prefix = false;
+		for (uint8_t j = 0; j < nchords; j++) {
+			if (i != j && chords[i].mask.within(chords[j].mask) &&
+					chords[i].mask != chords[j].mask) {
+				chords[i].prefix = true;
+				break;
+			}
+		}
+		uint32_t h = hash(chords[i].mask);
+		while (table[h]) h = (h + 1) & (size - 1);
+		table[h] = i + 1;
+	}
+	reset();
+}
+
+const IKChords::chord_t *IKChords::lookup(const IKChordMask &mask) const
+{
+	const uint32_t size = 1 << IK_CHORD_HASH_BITS;
+	uint32_t h = hash(mask);
+
+	while (table[h]) {
+		const chord_t *c = &chords[table[h] - 1];
+		if (c->mask == mask) return c;
+		h = (h + 1) & (size - 1);
+	}
+	return NULL;
+}
+
+void IKChords::fire(const chord_t *c)
+{
+	fired = true;
+	window_open = false;
+	if (chord_callback) (*chord_callback)(c->id);
+}
+
+void IKChords::resolve(void)
+{
+	if (!window_open) return;
+	window_open = false;
+	const chord_t *c = lookup(gathered);
+	if (c) fire(c);
+}
+
+void IKChords::press(const IKChordMask &input, uint32_t now)
+{
+	held |= input;
+	if (fired) return;
+	if (window_open && (now - window_start) >= window) resolve();
+	if (fired) return;
+	if (!window_open) {
+		window_open = true;
+		window_start = now;
+		gathered.clear();
+	}
+	gathered |= input;
+	const chord_t *c = lookup(gathered);
+	if (c && !c->prefix) fire(c);
+}
+
+void IKChords::release(const IKChordMask &input)
+{
+	held.remove(input);
+	resolve();
+	if (held.empty()) {
+		fired = false;
+		gathered.clear();
+	}
+}
+
+void IKChords::task(uint32_t now)
+{
+	if (window_open && (now - window_start) >= window) resolve();
+}
@@ -0,0 +1,154 @@
+/* IntelliKeys chord recognizer
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_CHORD_H_
+#define _IK_CHORD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "ik_regionmap.h"
+
+#ifndef IK_CHORD_MAX
+#define IK_CHORD_MAX 32
+#endif
+// Hash table size is 1 << IK_CHORD_HASH_BITS, at least twice IK_CHORD_MAX
+#ifndef IK_CHORD_HASH_BITS
+#define IK_CHORD_HASH_BITS 6
+#endif
+#if IK_CHORD_MAX > 254 || (1 << IK_CHORD_HASH_BITS) < 2*IK_CHORD_MAX
+#error "IK_CHORD_MAX must be at most 254 and 1 << IK_CHORD_HASH_BITS at least twice it"
+#endif
+
+// Chord inputs are bits in an IKChordMask. Every region of an IKRegionMap
+// has a bit, followed by IK_CHORD_SWITCHES switch bits.
+#define IK_CHORD_SWITCHES    8
+#define IK_CHORD_SWITCH_BASE IK_REGIONMAP_MAX
+#define IK_CHORD_INPUTS      (IK_REGIONMAP_MAX + IK_CHORD_SWITCHES)
+#define IK_CHORD_WORDS       ((IK_CHORD_INPUTS + 31) / 32)
+#define IK_CHORD_REGION(r)   IKChordMask::bit(r)
+#define IK_CHORD_SWITCH(s)   IKChordMask::bit(IK_CHORD_SWITCH_BASE + (s))
+
+class IKChordMask {
+public:
+	uint32_t words[IK_CHORD_WORDS];
+
+	IKChordMask() { clear(); }
+	void clear(void) { memset(words, 0, sizeof(words)); }
+	static IKChordMask bit(int input) {
+		IKChordMask m;
+		if (input >= 0 && input < IK_CHORD_INPUTS) m.words[input >> 5] = 1UL << (input & 31);
+		return m;
+	}
+	bool empty(void) const {
+		for (int i = 0; i < IK_CHORD_WORDS; i++) {
+			if (words[i]) return false;
+		}
+		return true;
+	}
+	// Every input of this mask is also in other
+	bool within(const IKChordMask &other) const {
+		for (int i = 0; i < IK_CHORD_WORDS; i++) {
+			if (words[i] & ~other.words[i]) return false;
+		}
+		return true;
+	}
+	bool operator==(const IKChordMask &other) const {
+		return memcmp(words, other.words, sizeof(words)) == 0;
+	}
+	bool operator!=(const IKChordMask &other) const { return !(*this == other); }
+	IKChordMask &operator|=(const IKChordMask &other) {
+		for (int i = 0; i < IK_CHORD_WORDS; i++) words[i] |= other.words[i];
+		return *this;
+	}
+	IKChordMask operator|(const IKChordMask &other) const {
+		IKChordMask m = *this;
+		return m |= other;
+	}
+	IKChordMask &remove(const IKChordMask &other) {
+		for (int i = 0; i < IK_CHORD_WORDS; i++) words[i] &= ~other.words[i];
+		return *this;
+	}
+};
+
+/*
+ * Detect chords, sets of regions and switches pressed together within a
+ * time window. Chords are compiled into a hash table keyed by their input
+ * mask so matching costs one lookup per event however many chords are
+ * defined.
+ *
+ * The window opens on the first press. A chord that is not part of a
+ * larger chord fires as soon as its last input is pressed. Otherwise the
+ * chord fires when the window closes or an input is released. Once a chord
+ * fires, no other chord fires until all inputs are released.
+ */
+class IKChords {
+public:
+	IKChords() { clear(); }
+	void clear(void);
+	// Returns false if the table is full or mask is empty
+	bool add(const IKChordMask &mask, uint8_t id);
+	void compile(void);
+	void setWindow(uint16_t window_ms) { window = window_ms; }
+	void onChord(void (*function)(int id)) { chord_callback = function; }
+	// Feed from onMembranePress/onMembraneRelease (region numbers) and onSwitch
+	void pressRegion(int region, uint32_t now) {
+		if (region >= 0 && region < IK_REGIONMAP_MAX) press(IK_CHORD_REGION(region), now);
+	}
+	void releaseRegion(int region) {
+		if (region >= 0 && region < IK_REGIONMAP_MAX) release(IK_CHORD_REGION(region));
+	}
+	void pressSwitch(int sw, uint32_t now) {
+		if (sw >= 0 && sw < IK_CHORD_SWITCHES) press(IK_CHORD_SWITCH(sw), now);
+	}
+	void releaseSwitch(int sw) {
+		if (sw >= 0 && sw < IK_CHORD_SWITCHES) release(IK_CHORD_SWITCH(sw));
+	}
+	void press(const IKChordMask &input, uint32_t now);
+	void release(const IKChordMask &input);
+	// Call from loop() to close the window
+	void task(uint32_t now);
+	void reset(void);
+private:
+	typedef struct {
+		IKChordMask mask;
+		uint8_t id;
+		bool prefix;	// part of a larger chord
+	} chord_t;
+	const chord_t *lookup(const IKChordMask &mask) const;
+	static uint32_t hash(const IKChordMask &mask);
+	void resolve(void);
+	void fire(const chord_t *c);
+	chord_t chords[IK_CHORD_MAX];
+	uint8_t nchords;
+	uint8_t table[1 << IK_CHORD_HASH_BITS];	// index+1 into chords, 0 = empty
+	uint16_t window;
+	void (*chord_callback)(int id);
+	IKChordMask held;
+	IKChordMask gathered;
+	uint32_t window_start;
+	bool window_open;
+	bool fired;
+};
+
+#endif
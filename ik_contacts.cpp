@@ -0,0 +1,269 @@
+/* IntelliKeys contact tracker
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_contacts.h"
+
+void IKContactTracker::reset(void)
+{
+	memset(label, 0, sizeof(label));
+	memset(used, 0, sizeof(used));
+	next_id = 1;
+}
+
+int IKContactTracker::count(void) const
+{
+	int n = 0;
+	for (int i = 0; i < IK_CONTACT_MAX; i++) {
+		if (used[i]) n++;
+	}
+	return n;
+}
+
+const ik_contact_t *IKContactTracker::contact(uint8_t id) const
+{
+	for (int i = 0; i < IK_CONTACT_MAX; i++) {
+		if (used[i] && contacts[i].id == id) return &contacts[i];
+	}
+	return NULL;
+}
+
+int IKContactTracker::allocate(void)
+{
+	for (int i = 0; i < IK_CONTACT_MAX; i++) {
+		if (!used[i]) {
+			used[i] = true;
+			ik_contact_t *c = &contacts[i];
+			c->id = next_id;
+			if (++next_id == 0) next_id = 1;
+			c->area = 0;
+			c->left = IK_RESOLUTION_X;
+			c->top = IK_RESOLUTION_Y;
+			c->right = 0;
+			c->bottom = 0;
+			sumx[i] = 0;
+			sumy[i] = 0;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void IKContactTracker::add_cell(int s, int x, int y)
+{
+	ik_contact_t *c = &contacts[s];
+	label[IKBitmap::cell(x, y)] = s + 1;
+	c->area++;
+	sumx[s] += x;
+	sumy[s] += y;
+	if (x < c->left) c->left = x;
+	if (x > c->right) c->right = x;
+	if (y < c->top) c->top = y;
+	if (y > c->bottom) c->bottom = y;
+}
+
+// Rebuild area, sums and bounding box from the cells inside the given box
+void IKContactTracker::recompute(int s, int left, int top, int right, int bottom)
+{
+	ik_contact_t *c = &contacts[s];
+	c->area = 0;
+	c->left = IK_RESOLUTION_X;
+	c->top = IK_RESOLUTION_Y;
+	c->right = 0;
+	c->bottom = 0;
+	sumx[s] = 0;
+	sumy[s] = 0;
+	for (int y = top; y <= bottom; y++) {
+		for (int x = left; x <= right; x++) {
+			if (label[IKBitmap::cell(x, y)] == s + 1) add_cell(s, x, y);
+		}
+	}
+}
+
+/*
+ * Mark the cells labelled l connected to (x,y) in visited, searching only
+ * inside the bounding box of box. Returns the number of cells marked.
+ */
+int IKContactTracker::flood(uint8_t l, const ik_contact_t &box, int x, int y,
+		IKBitmap *visited)
+{
+	bool changed = true;
+	int n = 1;
+
+	visited->set(x, y);
+	while (changed) {
+		changed = false;
+		for (int cy = box.top; cy <= box.bottom; cy++) {
+			for (int cx = box.left; cx <= box.right; cx++) {
+				if (label[IKBitmap::cell(cx, cy)] != l || visited->test(cx, cy)) {
+					continue;
+				}
+				bool touching = false;
+				for (int dy = -1; dy <= 1 && !touching; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						if (IKBitmap::valid(cx + dx, cy + dy) &&
+								visited->test(cx + dx, cy + dy)) {
+							touching = true;
+							break;
+						}
+					}
+				}
+				if (touching) {
+					visited->set(cx, cy);
+					n++;
+					changed = true;
+				}
+			}
+		}
+	}
+	return n;
+}
+
+void IKContactTracker::notify(int s, int event)
+{
+	ik_contact_t *c = &contacts[s];
+	if (c->area) {
+		c->x = ((uint32_t)sumx[s] * IK_CONTACT_SCALE) / c->area + IK_CONTACT_SCALE/2;
+		c->y = ((uint32_t)sumy[s] * IK_CONTACT_SCALE) / c->area + IK_CONTACT_SCALE/2;
+	}
+	if (contact_callback) (*contact_callback)(*c, event);
+}
+
+void IKContactTracker::press(int x, int y)
+{
+	if (!IKBitmap::valid(x, y) || label[IKBitmap::cell(x, y)]) return;
+
+	// Contacts touching this cell
+	int found[IK_CONTACT_MAX];
+	int nfound = 0;
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			if (!IKBitmap::valid(x + dx, y + dy)) continue;
+			int l = label[IKBitmap::cell(x + dx, y + dy)];
+			if (l == 0) continue;
+			bool dup = false;
+			for (int i = 0; i < nfound; i++) {
+				if (found[i] == l - 1) dup = true;
+			}
+			if (!dup) found[nfound++] = l - 1;
+		}
+	}
+
+	if (nfound == 0) {
+		int s = allocate();
+		if (s < 0) return;
+		add_cell(s, x, y);
+		notify(s, IK_CONTACT_DOWN);
+		return;
+	}
+
+	// Keep the largest contact, absorb the others.
+	int keep = found[0];
+	for (int i = 1; i < nfound; i++) {
+		if (contacts[found[i]].area > contacts[keep].area) keep = found[i];
+	}
+	add_cell(keep, x, y);
+	for (int i = 0; i < nfound; i++) {
+		int s = found[i];
+		if (s == keep) continue;
+		ik_contact_t *c = &contacts[s];
+		for (int cy = c->top; cy <= c->bottom; cy++) {
+			for (int cx = c->left; cx <= c->right; cx++) {
+				if (label[IKBitmap::cell(cx, cy)] == s + 1) add_cell(keep, cx, cy);
+			}
+		}
+		c->area = 0;
+		used[s] = false;
+		notify(s, IK_CONTACT_UP);
+	}
+	notify(keep, IK_CONTACT_MOVE);
+}
+
+void IKContactTracker::release(int x, int y)
+{
+	if (!IKBitmap::valid(x, y)) return;
+	int l = label[IKBitmap::cell(x, y)];
+	if (l == 0) return;
+	int s = l - 1;
+	ik_contact_t *c = &contacts[s];
+
+	label[IKBitmap::cell(x, y)] = 0;
+	if (--c->area == 0) {
+		used[s] = false;
+		notify(s, IK_CONTACT_UP);
+		return;
+	}
+	sumx[s] -= x;
+	sumy[s] -= y;
+
+	// Shrink the bounding box if the cell was on its edge.
+	if (x == c->left || x == c->right || y == c->top || y == c->bottom) {
+		recompute(s, c->left, c->top, c->right, c->bottom);
+	}
+
+	// Did removing the cell split the contact? Only possible if it had
+	// more than one pressed neighbour.
+	int sx = -1, sy = -1, neighbours = 0;
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			if (IKBitmap::valid(x + dx, y + dy) &&
+					label[IKBitmap::cell(x + dx, y + dy)] == l) {
+				sx = x + dx;
+				sy = y + dy;
+				neighbours++;
+			}
+		}
+	}
+	if (neighbours > 1) {
+		IKBitmap visited;
+		if (flood(l, *c, sx, sy, &visited) < c->area) {
+			// Move every other piece to a new contact.
+			ik_contact_t box = *c;
+			for (int cy = box.top; cy <= box.bottom; cy++) {
+				for (int cx = box.left; cx <= box.right; cx++) {
+					if (label[IKBitmap::cell(cx, cy)] != l || visited.test(cx, cy)) {
+						continue;
+					}
+					IKBitmap piece;
+					flood(l, box, cx, cy, &piece);
+					// Out of contacts, leave the piece joined.
+					int n = allocate();
+					for (int py = box.top; py <= box.bottom; py++) {
+						for (int px = box.left; px <= box.right; px++) {
+							if (!piece.test(px, py)) continue;
+							visited.set(px, py);
+							if (n >= 0) label[IKBitmap::cell(px, py)] = n + 1;
+						}
+					}
+					if (n >= 0) {
+						recompute(n, box.left, box.top, box.right, box.bottom);
+						notify(n, IK_CONTACT_DOWN);
+					}
+				}
+			}
+			recompute(s, box.left, box.top, box.right, box.bottom);
+		}
+	}
+	notify(s, IK_CONTACT_MOVE);
+}
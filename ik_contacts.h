@@ -0,0 +1,92 @@
+/* IntelliKeys contact tracker
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_CONTACTS_H_
+#define _IK_CONTACTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ik_bitmap.h"
+
+#ifndef IK_CONTACT_MAX
+#define IK_CONTACT_MAX 10
+#endif
+
+// Centroid units per membrane cell
+#define IK_CONTACT_SCALE 256
+
+enum {
+	IK_CONTACT_DOWN,
+	IK_CONTACT_MOVE,
+	IK_CONTACT_UP
+};
+
+typedef struct {
+	uint8_t id;		// stable while the contact lasts, never 0
+	uint16_t x;		// centroid in 1/IK_CONTACT_SCALE cells
+	uint16_t y;
+	uint16_t area;		// pressed cells
+	uint8_t left, top, right, bottom;	// bounding box, inclusive
+} ik_contact_t;
+
+/*
+ * Group 8-way adjacent pressed cells into contacts such as fingertips.
+ * Each press or release updates one contact's cell count and coordinate
+ * sums so the centroid is available without rescanning the membrane. Only
+ * merges, splits and bounding box shrinks look at cells, and only inside
+ * the contact's bounding box.
+ */
+class IKContactTracker {
+public:
+	IKContactTracker() : contact_callback(NULL) { reset(); }
+	void reset(void);
+	// Feed from onMembranePress and onMembraneRelease
+	void press(int x, int y);
+	void release(int x, int y);
+	void onContact(void (*function)(const ik_contact_t &contact, int event)) {
+		contact_callback = function;
+	}
+	int count(void) const;
+	// Returns NULL if id is not an active contact
+	const ik_contact_t *contact(uint8_t id) const;
+	// Active contacts are slot 0..IK_CONTACT_MAX-1 where valid
+	const ik_contact_t *slot(int i) const {
+		return (i >= 0 && i < IK_CONTACT_MAX && used[i]) ? &contacts[i] : NULL;
+	}
+private:
+	int allocate(void);
+	void add_cell(int s, int x, int y);
+	void recompute(int s, int left, int top, int right, int bottom);
+	int flood(uint8_t l, const ik_contact_t &box, int x, int y, IKBitmap *visited);
+	void notify(int s, int event);
+	uint8_t label[IK_MEMBRANE_CELLS];	// slot+1, 0 = not pressed
+	ik_contact_t contacts[IK_CONTACT_MAX];
+	uint16_t sumx[IK_CONTACT_MAX];
+	uint16_t sumy[IK_CONTACT_MAX];
+	bool used[IK_CONTACT_MAX];
+	uint8_t next_id;
+	void (*contact_callback)(const ik_contact_t &contact, int event);
+};
+
+#endif
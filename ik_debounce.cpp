@@ -0,0 +1,113 @@
+/* IntelliKeys membrane debounce filter
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_debounce.h"
+
+void IKDebounce::setWindows(uint16_t press_ms, uint16_t release_ms)
+{
+	// Keep the cell state and pending confirmations. Cells held now must
+	// still see their release, and queued entries expire against the new
+	// windows.
+	press_window = press_ms;
+	release_window = release_ms;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void IKDebounce::reset(void)
+{
+	raw.clear();
+	reported.clear();
+	memset(stamp, 0, sizeof(stamp));
+	press_q.clear();
+	release_q.clear();
+}
+
+bool IKDebounce::press(int cell, uint16_t now)
+{
+	put(raw, cell, true);
+	stamp[cell] = now;
+	if (bit(reported, cell)) {
+		// Bounced during the release window, drop release and press.
+		stats.filtered += 2;
+		return false;
+	}
+	if (press_window && press_q.push(cell, now)) {
+		return false;
+	}
+	put(reported, cell, true);
+	return true;
+}
+
+bool IKDebounce::release(int cell, uint16_t now)
+{
+	put(raw, cell, false);
+	stamp[cell] = now;
+	if (!bit(reported, cell)) {
+		// Released during the press window, drop press and release.
+		stats.filtered += 2;
+		return false;
+	}
+	if (release_window && release_q.push(cell, now)) {
+		return false;
+	}
+	put(reported, cell, false);
+	return true;
+}
+
+int IKDebounce::poll(uint16_t now, int *cell)
+{
+	IKTimedFifo<IK_DEBOUNCE_QUEUE>::entry_t p;
+
+	while (press_q.pop(now, press_window, &p)) {
+		// Skip entries overtaken by a later change to the same cell.
+		if (stamp[p.item] != p.time || !bit(raw, p.item) ||
+				bit(reported, p.item)) {
+			continue;
+		}
+		put(reported, p.item, true);
+		stats.delayed++;
+		stats.delay_ms += (uint16_t)(now - p.time);
+		*cell = p.item;
+		return IK_DEBOUNCE_PRESS;
+	}
+	while (release_q.pop(now, release_window, &p)) {
+		if (stamp[p.item] != p.time || bit(raw, p.item) ||
+				!bit(reported, p.item)) {
+			continue;
+		}
+		put(reported, p.item, false);
+		stats.delayed++;
+		stats.delay_ms += (uint16_t)(now - p.time);
+		*cell = p.item;
+		return IK_DEBOUNCE_RELEASE;
+	}
+	return IK_DEBOUNCE_NONE;
+}
+
+void IKDebounce::set(int cell, bool pressed)
+{
+	put(raw, cell, pressed);
+	put(reported, cell, pressed);
+}
@@ -0,0 +1,99 @@
+/* IntelliKeys membrane debounce filter
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_DEBOUNCE_H_
+#define _IK_DEBOUNCE_H_
+
+#include <stdint.h>
+#include "ik_bitmap.h"
+#include "ik_fifo.h"
+
+// Pending confirmations per direction, plus one
+#ifndef IK_DEBOUNCE_QUEUE
+#define IK_DEBOUNCE_QUEUE 32
+#endif
+
+enum {
+	IK_DEBOUNCE_NONE,
+	IK_DEBOUNCE_PRESS,
+	IK_DEBOUNCE_RELEASE
+};
+
+typedef struct {
+	uint32_t filtered;	// raw events never passed on
+	uint32_t delayed;	// events passed on after a confirm window
+	uint32_t delay_ms;	// total time added to delayed events
+} ik_debounce_stats_t;
+
+/*
+ * Per-cell press and release confirmation. A press is passed on once the
+ * cell has stayed pressed for press_ms, a release once it has stayed
+ * released for release_ms. Chatter inside either window is swallowed. Each
+ * cell keeps a 16 bit millisecond timestamp of its last raw change. All
+ * pending confirmations in one direction share the same window so they
+ * expire in the order they were queued, which keeps press(), release() and
+ * poll() O(1) per event. Feed every raw event through press() and
+ * release(), even with both windows 0, so the cell state is right when
+ * the windows change.
+ */
+class IKDebounce {
+public:
+	IKDebounce() { reset(); setWindows(0, 0); }
+	void setWindows(uint16_t press_ms, uint16_t release_ms);
+	// True while poll() has work: a window is set or entries are pending
+	bool enabled(void) const {
+		return press_window || release_window ||
+			!press_q.empty() || !release_q.empty();
+	}
+	void reset(void);
+	// Raw events. Return true if the event should be passed on now.
+	bool press(int cell, uint16_t now);
+	bool release(int cell, uint16_t now);
+	// Returns IK_DEBOUNCE_PRESS or IK_DEBOUNCE_RELEASE and sets *cell for
+	// the next confirmed event, or IK_DEBOUNCE_NONE.
+	int poll(uint16_t now, int *cell);
+	// Force a cell to a known state, for example after a resync
+	void set(int cell, bool pressed);
+	ik_debounce_stats_t stats;
+private:
+	static bool bit(const IKBitmap &b, int cell) {
+		return (b.words[cell >> 5] >> (cell & 31)) & 1;
+	}
+	static void put(IKBitmap &b, int cell, bool on) {
+		if (on) {
+			b.words[cell >> 5] |= (1UL << (cell & 31));
+		} else {
+			b.words[cell >> 5] &= ~(1UL << (cell & 31));
+		}
+	}
+	uint16_t press_window;
+	uint16_t release_window;
+	IKBitmap raw;		// state reported by the IK
+	IKBitmap reported;	// state passed on
+	uint16_t stamp[IK_MEMBRANE_CELLS];
+	IKTimedFifo<IK_DEBOUNCE_QUEUE> press_q;
+	IKTimedFifo<IK_DEBOUNCE_QUEUE> release_q;
+};
+
+#endif
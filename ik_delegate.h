@@ -0,0 +1,86 @@
+/* IntelliKeys callback delegates
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_DELEGATE_H_
+#define _IK_DELEGATE_H_
+
+#include <stddef.h>
+
+/*
+ * Callback that carries its own context, three pointers in size. It binds
+ * one of
+ *   a plain function             IKDelegate<int, int>(press)
+ *   a function plus a pointer    IKDelegate<int, int>(press, &board)
+ *     called as press(&board, x, y)
+ *   a member function            IKDelegate<int, int>::member<Board, &Board::press>(&board)
+ * The call goes through one static thunk, with no heap and no virtual
+ * functions.
+ */
+template <typename... Args>
+class IKDelegate {
+public:
+	typedef void (*function_t)(Args...);
+	typedef void (*context_function_t)(void *context, Args...);
+
+	IKDelegate() : thunk(NULL), context(NULL) { fn.plain = NULL; }
+	IKDelegate(function_t function) : context(NULL) {
+		fn.plain = function;
+		thunk = function ? plain_thunk : NULL;
+	}
+	IKDelegate(context_function_t function, void *ctx) : context(ctx) {
+		fn.with_context = function;
+		thunk = function ? context_thunk : NULL;
+	}
+	template <class T, void (T::*method)(Args...)>
+	static IKDelegate member(T *object) {
+		IKDelegate d;
+		d.context = object;
+		d.thunk = object ? member_thunk<T, method> : NULL;
+		return d;
+	}
+	explicit operator bool() const { return thunk != NULL; }
+	void operator()(Args... args) const {
+		if (thunk) thunk(*this, args...);
+	}
+private:
+	typedef void (*thunk_t)(const IKDelegate &d, Args...);
+	static void plain_thunk(const IKDelegate &d, Args... args) {
+		d.fn.plain(args...);
+	}
+	static void context_thunk(const IKDelegate &d, Args... args) {
+		d.fn.with_context(d.context, args...);
+	}
+	template <class T, void (T::*method)(Args...)>
+	static void member_thunk(const IKDelegate &d, Args... args) {
+		(static_cast<T *>(d.context)->*method)(args...);
+	}
+	thunk_t thunk;
+	void *context;
+	union {
+		function_t plain;
+		context_function_t with_context;
+	} fn;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/* IntelliKeys dwell (accept delay) activation
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_dwell.h"
+
+void IKDwell::setDwell(uint16_t dwell_ms)
+{
+	// Keep the region states so held regions still see their release.
+	// Queued presses expire against the new time.
+	dwell = dwell_ms;
+}
+
+void IKDwell::reset(void)
+{
+	memset(state, IDLE, sizeof(state));
+	queue.clear();
+}
+
+void IKDwell::press(int region, uint32_t now)
+{
+	if (region < 0 || region >= IK_REGIONMAP_MAX || state[region] != IDLE) return;
+	if (dwell == 0) {
+		state[region] = ACTIVE;
+		if (activate_callback) (*activate_callback)(region);
+		return;
+	}
+	// Presses cancelled by a release stay queued until they expire. If
+	// they fill the queue, drop them. Each region has at most one live
+	// entry so that always makes room, and a press is never activated
+	// early.
+	if (!queue.push(region, now)) {
+		queue.retain([this](const IKTimedFifo<IK_REGIONMAP_MAX + 1>::entry_t &e) {
+			return state[e.item] == WAITING && stamp[e.item] == e.time;
+		});
+		if (!queue.push(region, now)) return;
+	}
+	state[region] = WAITING;
+	stamp[region] = now;
+}
+
+void IKDwell::release(int region)
+{
+	if (region < 0 || region >= IK_REGIONMAP_MAX) return;
+	uint8_t old = state[region];
+	state[region] = IDLE;
+	// A cancelled WAITING entry stays queued and is skipped by task().
+	if (old == ACTIVE && deactivate_callback) (*deactivate_callback)(region);
+}
+
+void IKDwell::task(uint32_t now)
+{
+	IKTimedFifo<IK_REGIONMAP_MAX + 1>::entry_t p;
+
+	while (queue.pop(now, dwell, &p)) {
+		if (state[p.item] == WAITING && stamp[p.item] == p.time) {
+			state[p.item] = ACTIVE;
+			if (activate_callback) (*activate_callback)(p.item);
+		}
+	}
+}
@@ -0,0 +1,68 @@
+/* IntelliKeys dwell (accept delay) activation
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_DWELL_H_
+#define _IK_DWELL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ik_regionmap.h"
+#include "ik_fifo.h"
+
+/*
+ * Accept delay for users who rest their hands on the overlay. A region
+ * activates only after it has been held for the dwell time and is
+ * cancelled if released first. Feed it the region numbers returned by
+ * IKRegionMap press() and release() from the onMembranePress and
+ * onMembraneRelease callbacks and call task() from loop().
+ *
+ * Every region waits the same time, so one IKTimedFifo serves as the
+ * timer for all pending regions.
+ */
+class IKDwell {
+public:
+	IKDwell() : activate_callback(NULL), deactivate_callback(NULL) { reset(); setDwell(0); }
+	// 0 activates on press
+	void setDwell(uint16_t dwell_ms);
+	void onActivate(void (*function)(int region)) { activate_callback = function; }
+	// Called when an activated region is released
+	void onDeactivate(void (*function)(int region)) { deactivate_callback = function; }
+	void press(int region, uint32_t now);
+	void release(int region);
+	void task(uint32_t now);
+	void reset(void);
+	bool active(int region) const {
+		return (region >= 0 && region < IK_REGIONMAP_MAX) && (state[region] == ACTIVE);
+	}
+private:
+	enum { IDLE, WAITING, ACTIVE };
+	uint16_t dwell;
+	void (*activate_callback)(int region);
+	void (*deactivate_callback)(int region);
+	uint8_t state[IK_REGIONMAP_MAX];
+	uint16_t stamp[IK_REGIONMAP_MAX];
+	IKTimedFifo<IK_REGIONMAP_MAX + 1> queue;
+};
+
+#endif
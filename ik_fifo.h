@@ -0,0 +1,81 @@
+/* IntelliKeys timed FIFO
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _IK_FIFO_H_
+#define _IK_FIFO_H_
+
+#include <stdint.h>
+
+/*
+ * FIFO of items stamped with a 16 bit millisecond time, shared by the
+ * debounce and dwell timers. Every entry of one queue waits the same time,
+ * so entries expire in the order they were queued and the queue is the
+ * timer for all of them. Holds SIZE - 1 entries. 16 bit stamps cover waits
+ * up to 65 seconds.
+ */
+template <uint16_t SIZE>
+class IKTimedFifo {
+public:
+	typedef struct {
+		uint16_t item;
+		uint16_t time;
+	} entry_t;
+
+	IKTimedFifo() { clear(); }
+	void clear(void) { head = tail = 0; }
+	bool empty(void) const { return head == tail; }
+	// Returns false if the queue is full
+	bool push(uint16_t item, uint16_t now) {
+		uint16_t next = advance(head);
+		if (next == tail) return false;
+		q[head].item = item;
+		q[head].time = now;
+		head = next;
+		return true;
+	}
+	// Remove the oldest entry into *e if it has waited at least wait ms
+	bool pop(uint16_t now, uint16_t wait, entry_t *e) {
+		if (empty() || (uint16_t)(now - q[tail].time) < wait) return false;
+		*e = q[tail];
+		tail = advance(tail);
+		return true;
+	}
+	// Drop the entries keep(entry) returns false for, keeping the order
+	template <class Keep>
+	void retain(Keep keep) {
+		uint16_t to = tail;
+		for (uint16_t i = tail; i != head; i = advance(i)) {
+			if (!keep(q[i])) continue;
+			q[to] = q[i];
+			to = advance(to);
+		}
+		head = to;
+	}
+private:
+	static_assert(SIZE >= 2, "IKTimedFifo needs at least 2 slots");
+	static uint16_t advance(uint16_t i) { return (i + 1 == SIZE) ? 0 : i + 1; }
+	entry_t q[SIZE];
+	uint16_t head, tail;
+};
+
+#endif
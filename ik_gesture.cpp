@@ -0,0 +1,129 @@
+/* IntelliKeys multi-finger gestures
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include "ik_gesture.h"
+
+void IKGestures::reset(void)
+{
+	fingers = 0;
+	scroll_acc = pinch_acc = 0;
+	scroll_pending = pinch_pending = 0;
+	last_report = 0;
+}
+
+int32_t IKGestures::distance(void) const
+{
+	int32_t dx = (int32_t)finger[0].x - finger[1].x;
+	int32_t dy = (int32_t)finger[0].y - finger[1].y;
+	uint32_t sq = dx*dx + dy*dy;
+	// Integer square root
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+	while (bit > sq) bit >>= 2;
+	while (bit) {
+		if (sq >= root + bit) {
+			sq -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+void IKGestures::start(void)
+{
+	last_y = middle_y();
+	last_distance = distance();
+	scroll_acc = pinch_acc = 0;
+}
+
+void IKGestures::contact(const ik_contact_t &c, int event, uint32_t now)
+{
+	int i;
+
+	for (i = 0; i < fingers; i++) {
+		if (finger[i].id == c.id) break;
+	}
+	switch (event) {
+		case IK_CONTACT_DOWN:
+			if (i < fingers || fingers >= 2) break;
+			finger[fingers].id = c.id;
+			finger[fingers].x = c.x;
+			finger[fingers].y = c.y;
+			if (++fingers == 2) start();
+			break;
+		case IK_CONTACT_MOVE:
+			if (i >= fingers) break;
+			finger[i].x = c.x;
+			finger[i].y = c.y;
+			if (fingers == 2) {
+				int32_t y = middle_y();
+				int32_t d = distance();
+				int32_t dy = last_y - y;
+				int32_t dd = d - last_distance;
+				last_y = y;
+				last_distance = d;
+				// Whichever movement is larger wins.
+				if (abs(dd) > abs(dy)) {
+					pinch_acc += dd;
+					pinch_pending += pinch_acc / pinch_step;
+					pinch_acc %= pinch_step;
+				} else {
+					scroll_acc += dy;
+					scroll_pending += scroll_acc / scroll_step;
+					scroll_acc %= scroll_step;
+				}
+			}
+			break;
+		case IK_CONTACT_UP:
+			if (i >= fingers) break;
+			if (i == 0) finger[0] = finger[1];
+			fingers--;
+			scroll_acc = pinch_acc = 0;
+			break;
+		default:
+			break;
+	}
+	task(now);
+}
+
+void IKGestures::task(uint32_t now)
+{
+	if (scroll_pending == 0 && pinch_pending == 0) return;
+	if ((now - last_report) < report_interval) return;
+	last_report = now;
+	if (scroll_pending) {
+		int steps = scroll_pending;
+		scroll_pending = 0;
+		if (scroll_callback) (*scroll_callback)(steps);
+	}
+	if (pinch_pending) {
+		int steps = pinch_pending;
+		pinch_pending = 0;
+		if (pinch_callback) (*pinch_callback)(steps);
+	}
+}
@@ -0,0 +1,83 @@
+/* IntelliKeys multi-finger gestures
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_GESTURE_H_
+#define _IK_GESTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ik_contacts.h"
+
+/*
+ * Two finger gestures from IKContactTracker contacts. Moving two fingers
+ * together up or down scrolls, moving them apart or together pinches.
+ * Movement is accumulated between reports so callbacks run at most once
+ * per report interval whatever the event rate.
+ */
+class IKGestures {
+public:
+	IKGestures() : scroll_callback(NULL), pinch_callback(NULL) {
+		setScrollStep(IK_CONTACT_SCALE);
+		setPinchStep(2*IK_CONTACT_SCALE);
+		setReportInterval(20);
+		reset();
+	}
+	// Centroid movement (1/IK_CONTACT_SCALE cells) per scroll or pinch step
+	void setScrollStep(uint16_t units) { scroll_step = units ? units : 1; }
+	void setPinchStep(uint16_t units) { pinch_step = units ? units : 1; }
+	void setReportInterval(uint16_t ms) { report_interval = ms; }
+	// steps > 0 when the fingers move up
+	void onScroll(void (*function)(int steps)) { scroll_callback = function; }
+	// steps > 0 when the fingers move apart
+	void onPinch(void (*function)(int steps)) { pinch_callback = function; }
+	// Feed from IKContactTracker::onContact
+	void contact(const ik_contact_t &c, int event, uint32_t now);
+	// Call from loop() to send movement held back by the report interval
+	void task(uint32_t now);
+	void reset(void);
+private:
+	int32_t distance(void) const;
+	int32_t middle_y(void) const { return ((int32_t)finger[0].y + finger[1].y) / 2; }
+	void start(void);
+	struct {
+		uint8_t id;
+		uint16_t x;
+		uint16_t y;
+	} finger[2];
+	uint8_t fingers;
+	int32_t last_y;
+	int32_t last_distance;
+	int32_t scroll_acc;
+	int32_t pinch_acc;
+	int16_t scroll_pending;
+	int16_t pinch_pending;
+	uint32_t last_report;
+	uint16_t scroll_step;
+	uint16_t pinch_step;
+	uint16_t report_interval;
+	void (*scroll_callback)(int steps);
+	void (*pinch_callback)(int steps);
+};
+
+#endif
@@ -0,0 +1,101 @@
+/* IntelliKeys overlay keymap registry
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_overlay.h"
+
+IKOverlayRegistry::IKOverlayRegistry()
+{
+	swap_callback = NULL;
+	memset(maps, 0, sizeof(maps));
+	fallback = NULL;
+	current = NULL;
+	current_id = IK_OVERLAY_NONE;
+	pending = false;
+	down.clear();
+	held = 0;
+}
+
+void IKOverlayRegistry::add(int id, IKRegionMap *map)
+{
+	if (id < 0 || id >= IK_OVERLAY_MAX) return;
+	maps[id] = map;
+	if (id == current_id) select(id);
+}
+
+void IKOverlayRegistry::setDefault(IKRegionMap *map)
+{
+	fallback = map;
+	if (current == NULL || lookup(current_id) != current) select(current_id);
+}
+
+IKRegionMap *IKOverlayRegistry::lookup(int id) const
+{
+	if (id >= 0 && id < IK_OVERLAY_MAX && maps[id]) return maps[id];
+	return fallback;
+}
+
+void IKOverlayRegistry::select(int id)
+{
+	pending_id = (id >= 0 && id < IK_OVERLAY_MAX) ? id : IK_OVERLAY_NONE;
+	pending = true;
+	if (held == 0) swap();
+}
+
+void IKOverlayRegistry::swap(void)
+{
+	pending = false;
+	IKRegionMap *next = lookup(pending_id);
+	bool changed = (next != current);
+	current_id = pending_id;
+	current = next;
+	if (!changed) return;
+	if (current) current->reset();
+	if (swap_callback) (*swap_callback)(current_id, current);
+}
+
+int IKOverlayRegistry::press(int x, int y)
+{
+	if (!IKBitmap::valid(x, y) || down.test(x, y)) return -1;
+	if (pending && held == 0) swap();
+	down.set(x, y);
+	held++;
+	return current ? current->press(x, y) : -1;
+}
+
+int IKOverlayRegistry::release(int x, int y)
+{
+	if (!IKBitmap::valid(x, y) || !down.test(x, y)) return -1;
+	down.reset(x, y);
+	held--;
+	return current ? current->release(x, y) : -1;
+}
+
+void IKOverlayRegistry::reset(void)
+{
+	down.clear();
+	held = 0;
+	if (current) current->reset();
+	if (pending) swap();
+}
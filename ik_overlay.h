@@ -0,0 +1,76 @@
+/* IntelliKeys overlay keymap registry
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_OVERLAY_H_
+#define _IK_OVERLAY_H_
+
+#include <stdint.h>
+#include "ik_regionmap.h"
+
+// Overlay IDs from the three sensor bits
+#define IK_OVERLAY_MAX (1 << IK_NUM_SENSORS)
+#define IK_OVERLAY_NONE -1
+
+/*
+ * Keymaps for each overlay ID. Membrane presses and releases go through
+ * the registry, which forwards them to the active keymap. select() changes
+ * the keymap only while no cell is pressed so every press is released on
+ * the keymap that saw it; otherwise the change waits for the next press
+ * with the membrane idle. The keymaps are compiled before use, so a
+ * change is a pointer swap.
+ */
+class IKOverlayRegistry {
+public:
+	IKOverlayRegistry();
+	// Keymap for overlay id, NULL to remove it
+	void add(int id, IKRegionMap *map);
+	// Keymap for overlays without their own, may be NULL
+	void setDefault(IKRegionMap *map);
+	void select(int id);
+	IKRegionMap *active(void) const { return current; }
+	int overlay(void) const { return current_id; }
+	// Called when the keymap changes, before the press that uses it
+	void onSwap(void (*function)(int id, IKRegionMap *map)) {
+		swap_callback = function;
+	}
+	// Same as IKRegionMap::press and release on the active keymap
+	int press(int x, int y);
+	int release(int x, int y);
+	// Forget pressed cells, for example on disconnect
+	void reset(void);
+private:
+	IKRegionMap *lookup(int id) const;
+	void swap(void);
+	void (*swap_callback)(int id, IKRegionMap *map);
+	IKRegionMap *maps[IK_OVERLAY_MAX];
+	IKRegionMap *fallback;
+	IKRegionMap *current;
+	int8_t current_id;
+	int8_t pending_id;
+	bool pending;
+	IKBitmap down;		// cells pressed through the registry
+	uint16_t held;
+};
+
+#endif
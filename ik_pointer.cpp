@@ -0,0 +1,107 @@
+/* IntelliKeys absolute pointer mapping
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "ik_pointer.h"
+
+void IKPointer::setArea(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+	area_x = x;
+	area_y = y;
+	area_width = width ? width : 1;
+	area_height = height ? height : 1;
+	reset();
+}
+
+void IKPointer::reset(void)
+{
+	tracking = 0;
+	pos_x = target_x = 0;
+	pos_y = target_y = 0;
+}
+
+/*
+ * Contact coordinate to output coordinate << 8. A centroid can be no
+ * closer to the edge than the centre of the edge cell, so the centres of
+ * the first and last cells map to 0 and out-1 and the corners are
+ * reachable.
+ */
+int32_t IKPointer::scale(int32_t v, int32_t origin, int32_t size, uint16_t out)
+{
+	const int32_t lo = IK_CONTACT_SCALE / 2;
+	const int32_t hi = size * IK_CONTACT_SCALE - IK_CONTACT_SCALE / 2;
+
+	if (hi <= lo || out < 2) return 0;
+	v -= origin * IK_CONTACT_SCALE;
+	if (v < lo) v = lo;
+	if (v > hi) v = hi;
+	return (int32_t)(((int64_t)(v - lo) * (out - 1) * 256) / (hi - lo));
+}
+
+void IKPointer::contact(const ik_contact_t &c, int event)
+{
+	if (event == IK_CONTACT_UP) {
+		if (c.id == tracking) tracking = 0;
+		return;
+	}
+	int32_t x = scale(c.x, area_x, area_width, out_width);
+	int32_t y = scale(c.y, area_y, area_height, out_height);
+	if (tracking == 0) {
+		int cx = c.x / IK_CONTACT_SCALE;
+		int cy = c.y / IK_CONTACT_SCALE;
+		if (cx < area_x || cx >= area_x + area_width ||
+				cy < area_y || cy >= area_y + area_height) {
+			return;
+		}
+		tracking = c.id;
+		pos_x = target_x = x;
+		pos_y = target_y = y;
+	} else if (c.id == tracking) {
+		target_x = x;
+		target_y = y;
+		smooth();
+	} else {
+		return;
+	}
+	if (move_callback) (*move_callback)(pos_x >> 8, pos_y >> 8);
+}
+
+// One smoothing step toward the target. The last step of less than one
+// 2^shift-th lands on it exactly. Returns false if already there.
+bool IKPointer::smooth(void)
+{
+	int32_t dx = (target_x - pos_x) >> smooth_shift;
+	int32_t dy = (target_y - pos_y) >> smooth_shift;
+
+	if (pos_x == target_x && pos_y == target_y) return false;
+	pos_x = dx ? pos_x + dx : target_x;
+	pos_y = dy ? pos_y + dy : target_y;
+	return true;
+}
+
+void IKPointer::task(uint32_t now)
+{
+	if (now - step_time < IK_POINTER_STEP_MS) return;
+	step_time = now;
+	if (smooth() && move_callback) (*move_callback)(pos_x >> 8, pos_y >> 8);
+}
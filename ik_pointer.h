@@ -0,0 +1,85 @@
+/* IntelliKeys absolute pointer mapping
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_POINTER_H_
+#define _IK_POINTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ik_contacts.h"
+
+// Smoothing step while the contact rests, ms
+#ifndef IK_POINTER_STEP_MS
+#define IK_POINTER_STEP_MS 10
+#endif
+
+/*
+ * Map a contact on the membrane, or on a sub-rectangle of it, to an
+ * absolute screen position. Feed it from IKContactTracker::onContact and
+ * send the result with, for example, Mouse.moveTo(). The first contact
+ * that lands inside the area drives the pointer until it lifts.
+ *
+ * The first report of a touch goes straight to the touched position so
+ * one touch jumps the pointer there. Later movement is smoothed with an
+ * exponential moving average, new = old + (raw - old) / 2^shift. Call
+ * task() from loop() so the pointer keeps closing in on the contact once
+ * it stops moving.
+ */
+class IKPointer {
+public:
+	IKPointer() : step_time(0), move_callback(NULL) {
+		setArea(0, 0, IK_RESOLUTION_X, IK_RESOLUTION_Y);
+		setOutput(32768, 32768);
+		setSmoothing(2);
+	}
+	// Membrane cells that cover the screen
+	void setArea(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+	// Output coordinates run from 0 to width-1 and 0 to height-1
+	void setOutput(uint16_t width, uint16_t height) {
+		out_width = width;
+		out_height = height;
+	}
+	// 0 = no smoothing
+	void setSmoothing(uint8_t shift) { smooth_shift = shift; }
+	void onMove(void (*function)(int x, int y)) { move_callback = function; }
+	void contact(const ik_contact_t &c, int event);
+	void task(uint32_t now);
+	bool touching(void) const { return tracking != 0; }
+	// Forget the contact being tracked, for example when the contact
+	// tracker is reset
+	void reset(void);
+private:
+	int32_t scale(int32_t v, int32_t origin, int32_t size, uint16_t out);
+	bool smooth(void);
+	uint8_t area_x, area_y, area_width, area_height;
+	uint16_t out_width, out_height;
+	uint8_t smooth_shift;
+	uint8_t tracking;		// contact id, 0 = none
+	int32_t pos_x, pos_y;		// output units << 8
+	int32_t target_x, target_y;
+	uint32_t step_time;
+	void (*move_callback)(int x, int y);
+};
+
+#endif
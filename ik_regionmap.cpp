@@ -0,0 +1,88 @@
+/* IntelliKeys overlay region map
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ik_regionmap.h"
+
+void IKRegionMap::clear(void)
+{
+	memset(cell_region, IK_REGION_NONE, sizeof(cell_region));
+	nregions = 0;
+	reset();
+}
+
+void IKRegionMap::reset(void)
+{
+	memset(refcount, 0, sizeof(refcount));
+}
+
+int IKRegionMap::compile(const ik_region_t *regions, int count)
+{
+	clear();
+	if (count < 0 || count > IK_REGIONMAP_MAX || count >= IK_REGION_NONE) return -1;
+	for (int i = 0; i < count; i++) {
+		const ik_region_t *r = &regions[i];
+		for (int y = r->y; y < r->y + r->height && y < IK_RESOLUTION_Y; y++) {
+			for (int x = r->x; x < r->x + r->width && x < IK_RESOLUTION_X; x++) {
+				cell_region[IKBitmap::cell(x, y)] = i;
+			}
+		}
+	}
+	nregions = count;
+	return count;
+}
+
+int IKRegionMap::compileGrid(int cols, int rows)
+{
+	clear();
+	if (cols < 1 || rows < 1 || cols > IK_RESOLUTION_X || rows > IK_RESOLUTION_Y ||
+			cols*rows > IK_REGIONMAP_MAX || cols*rows >= IK_REGION_NONE) {
+		return -1;
+	}
+	for (int y = 0; y < IK_RESOLUTION_Y; y++) {
+		int row = (y * rows) / IK_RESOLUTION_Y;
+		for (int x = 0; x < IK_RESOLUTION_X; x++) {
+			int col = (x * cols) / IK_RESOLUTION_X;
+			cell_region[IKBitmap::cell(x, y)] = (row * cols) + col;
+		}
+	}
+	nregions = cols * rows;
+	return nregions;
+}
+
+int IKRegionMap::press(int x, int y)
+{
+	int r = region(x, y);
+	if (r < 0) return -1;
+	if (refcount[r]++ != 0) return -1;
+	return r;
+}
+
+int IKRegionMap::release(int x, int y)
+{
+	int r = region(x, y);
+	if (r < 0 || refcount[r] == 0) return -1;
+	if (--refcount[r] != 0) return -1;
+	return r;
+}
@@ -0,0 +1,88 @@
+/* IntelliKeys overlay region map
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_REGIONMAP_H_
+#define _IK_REGIONMAP_H_
+
+#include <stdint.h>
+#include "ik_bitmap.h"
+
+#ifndef IK_REGIONMAP_MAX
+#define IK_REGIONMAP_MAX 128
+#endif
+// Region numbers are uint8_t and 0xFF means no region
+#if IK_REGIONMAP_MAX > 255
+#error "IK_REGIONMAP_MAX must be at most 255"
+#endif
+
+#define IK_REGION_NONE 0xFF
+
+// Rectangle of membrane cells
+typedef struct {
+	uint8_t x;
+	uint8_t y;
+	uint8_t width;
+	uint8_t height;
+} ik_region_t;
+
+/*
+ * Map membrane cells to overlay regions (virtual keys). compile() turns a
+ * list of rectangles into a 576 entry cell to region table so each press or
+ * release costs one table load plus a per-region reference count update.
+ * Regions may be any size so large keys such as a space bar need no special
+ * handling.
+ */
+class IKRegionMap {
+public:
+	IKRegionMap() { clear(); }
+	IKRegionMap(int cols, int rows) { compileGrid(cols, rows); }
+	void clear(void);
+	// Region i covers regions[i]. Later regions win where they overlap.
+	// Returns the number of regions or -1 if there are too many.
+	int compile(const ik_region_t *regions, int count);
+	// Uniform grid numbered row*cols + col, starting top left
+	int compileGrid(int cols, int rows);
+	int regions(void) const { return nregions; }
+	int region(int x, int y) const {
+		if (!IKBitmap::valid(x, y)) return -1;
+		uint8_t r = cell_region[IKBitmap::cell(x, y)];
+		return (r == IK_REGION_NONE) ? -1 : r;
+	}
+	// Returns the region if this is its first pressed cell, else -1
+	int press(int x, int y);
+	// Returns the region if this was its last pressed cell, else -1
+	int release(int x, int y);
+	// Number of cells pressed in region
+	int pressed(int region) const {
+		return (region >= 0 && region < nregions) ? refcount[region] : 0;
+	}
+	// Forget all pressed cells
+	void reset(void);
+private:
+	uint8_t cell_region[IK_MEMBRANE_CELLS];
+	uint8_t refcount[IK_REGIONMAP_MAX];
+	uint8_t nregions;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/* IntelliKeys overlay sensor thresholds
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "ik_sensor.h"
+
+void IKSensors::setHysteresis(uint8_t percent)
+{
+	hysteresis = (percent > 100) ? 100 : percent;
+	for (int i = 0; i < IK_NUM_SENSORS; i++) thresholds(sensors[i]);
+}
+
+void IKSensors::reset(void)
+{
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		sensors[i].low = 150 - IK_SENSOR_MIN_SPAN/2;
+		sensors[i].high = 150 + IK_SENSOR_MIN_SPAN/2;
+		sensors[i].state = IK_SENSOR_UNKNOWN;
+		thresholds(sensors[i]);
+	}
+}
+
+void IKSensors::calibrate(int sensor, uint8_t black, uint8_t white)
+{
+	if (sensor < 0 || sensor >= IK_NUM_SENSORS) return;
+	sensor_t &s = sensors[sensor];
+	s.low = (black < white) ? black : white;
+	s.high = (black < white) ? white : black;
+	if (s.high - s.low < IK_SENSOR_MIN_SPAN) {
+		int mid = (s.low + s.high) / 2;
+		if (mid < IK_SENSOR_MIN_SPAN/2) mid = IK_SENSOR_MIN_SPAN/2;
+		if (mid > 255 - IK_SENSOR_MIN_SPAN/2) mid = 255 - IK_SENSOR_MIN_SPAN/2;
+		s.low = mid - IK_SENSOR_MIN_SPAN/2;
+		s.high = mid + IK_SENSOR_MIN_SPAN/2;
+	}
+	thresholds(s);
+}
+
+void IKSensors::forget(void)
+{
+	for (int i = 0; i < IK_NUM_SENSORS; i++) sensors[i].state = IK_SENSOR_UNKNOWN;
+}
+
+void IKSensors::thresholds(sensor_t &s)
+{
+	int mid = (s.low + s.high) / 2;
+	int band = ((s.high - s.low) * hysteresis) / 200;
+
+	s.on = mid + band;
+	s.off = mid - band;
+}
+
+// Move level toward value, keeping it at least IK_SENSOR_MIN_SPAN from other
+void IKSensors::track(sensor_t &s, uint8_t &level, int value, int other)
+{
+	int next = level + (value - level) / (1 << IK_SENSOR_DRIFT_SHIFT);
+
+	if (next == level) return;
+	if (next > other - IK_SENSOR_MIN_SPAN && next < other + IK_SENSOR_MIN_SPAN) return;
+	level = next;
+	thresholds(s);
+}
+
+int IKSensors::update(int sensor, uint8_t value)
+{
+	if (sensor < 0 || sensor >= IK_NUM_SENSORS) return -1;
+	sensor_t &s = sensors[sensor];
+	uint8_t next = s.state;
+
+	if (s.state == IK_SENSOR_UNKNOWN) {
+		next = (value > (s.low + s.high) / 2);
+	} else if (value > s.on) {
+		next = 1;
+	} else if (value < s.off) {
+		next = 0;
+	}
+	// Only samples outside the band follow drift so values near the
+	// midpoint can't pull the levels together.
+	if (value > s.on) {
+		track(s, s.high, value, s.low);
+	} else if (value < s.off) {
+		track(s, s.low, value, s.high);
+	}
+	if (next == s.state) return -1;
+	s.state = next;
+	return next;
+}
@@ -0,0 +1,80 @@
+/* IntelliKeys overlay sensor thresholds
+ * Copyright 2018 gdsports625@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _IK_SENSOR_H_
+#define _IK_SENSOR_H_
+
+#include <stdint.h>
+#include "intellikeysdefs.h"
+
+// Hysteresis band as a percent of the low/high span
+#ifndef IK_SENSOR_HYSTERESIS
+#define IK_SENSOR_HYSTERESIS 20
+#endif
+// Drift tracking never lets low and high get closer than this
+#ifndef IK_SENSOR_MIN_SPAN
+#define IK_SENSOR_MIN_SPAN 16
+#endif
+// Each sample moves low or high 1/2^IK_SENSOR_DRIFT_SHIFT of the way
+#ifndef IK_SENSOR_DRIFT_SHIFT
+#define IK_SENSOR_DRIFT_SHIFT 3
+#endif
+
+#define IK_SENSOR_UNKNOWN 255
+
+/*
+ * Overlay sensor on/off detection. Each sensor has a low and high level,
+ * from the IK EEPROM calibration or defaults around 150. The on and off
+ * thresholds sit either side of the midpoint and are only recomputed when
+ * a level changes. Samples well clear of the band pull the matching level
+ * toward them so slow ambient light drift is followed.
+ */
+class IKSensors {
+public:
+	IKSensors() : hysteresis(IK_SENSOR_HYSTERESIS) { reset(); }
+	// Percent of the span, 0 for a single threshold
+	void setHysteresis(uint8_t percent);
+	// Back to the uncalibrated defaults
+	void reset(void);
+	void calibrate(int sensor, uint8_t black, uint8_t white);
+	// Report the next sample of every sensor
+	void forget(void);
+	// Returns the new state (0 or 1) if the sensor changed, else -1.
+	int update(int sensor, uint8_t value);
+	uint8_t state(int sensor) const { return sensors[sensor].state; }
+	uint8_t onThreshold(int sensor) const { return sensors[sensor].on; }
+	uint8_t offThreshold(int sensor) const { return sensors[sensor].off; }
+private:
+	typedef struct {
+		uint8_t low, high;	// levels
+		uint8_t on, off;	// thresholds
+		uint8_t state;
+	} sensor_t;
+	void thresholds(sensor_t &s);
+	void track(sensor_t &s, uint8_t &level, int value, int other);
+	sensor_t sensors[IK_NUM_SENSORS];
+	uint8_t hysteresis;
+};
+
+#endif
@@ -26,6 +26,7 @@
 #include "USBHost_t36.h"  // Read this header first for key info
 #include "intellikeysdefs.h"
 #include "intellikeys.h"
+#include <EEPROM.h>
 
 #define IK_VID          0x095e
 #define IK_PID_FWLOAD   0x0100  // Firmware load required
@@ -45,7 +46,7 @@
 #endif
 
 
-void IntelliKeys::init()
+void IntelliKeysBase::init()
 {
 	contribute_Pipes(mypipes, sizeof(mypipes)/sizeof(Pipe_t));
 	contribute_Transfers(mytransfers, sizeof(mytransfers)/sizeof(Transfer_t));
@@ -53,17 +54,23 @@ void IntelliKeys::init()
 	driver_ready_for_device(this);
 }
 
-bool IntelliKeys::claim(Device_t *dev, int type, const uint8_t *descriptors, uint32_t len)
+/*
+ * Set up the pipes for a board running the IK firmware. A board that needs
+ * its firmware loaded is only claimed if fwload is set.
+ */
+int IntelliKeysBase::claim_pipes(Device_t *dev, int type, const uint8_t *descriptors, uint32_t len,
+		bool fwload)
 {
-	if (type != 1) return false;
+	if (type != 1) return CLAIM_NONE;
 	debug_println("IntelliKeys claim this=", (uint32_t)this, HEX);
-	if (dev->idVendor != IK_VID) return false;
+	if (dev->idVendor != IK_VID) return CLAIM_NONE;
 	if (dev->idProduct == IK_PID_FWLOAD) {
+		if (!fwload) return CLAIM_NONE;
 		debug_println("found IntelliKeys, need FW load, pid=", dev->idProduct, HEX);
 		IK_state = 2;
-		return true;
+		return CLAIM_FWLOAD;
 	}
-	if (dev->idProduct != IK_PID_RUNNING) return false;
+	if (dev->idProduct != IK_PID_RUNNING) return CLAIM_NONE;
 	debug_println("found IntelliKeys, pid=", dev->idProduct, HEX);
 	memset((void*)rxpipe, 0, sizeof(rxpipe));
 	txpipe = NULL;
@@ -71,11 +78,11 @@ bool IntelliKeys::claim(Device_t *dev, int type, const uint8_t *descriptors, uin
 	const uint8_t *end = p + len;
 	int descriptorLength = p[0];
 	int descriptorType = p[1];
-	if (descriptorLength < 9 || descriptorType != 4) return false;
+	if (descriptorLength < 9 || descriptorType != 4) return CLAIM_NONE;
 	p += descriptorLength;
 	while (p < end) {
 		descriptorLength = p[0];
-		if (p + descriptorLength > end) return false; // reject if beyond end of data
+		if (p + descriptorLength > end) return CLAIM_NONE; // reject if beyond end of data
 		descriptorType = p[1];
 		if (descriptorType == 5) { // 5 = endpoint
 			bool epIN = (p[2] & 0xF0) == 0x80;	// true=IN, false=OUT
@@ -105,32 +112,41 @@ bool IntelliKeys::claim(Device_t *dev, int type, const uint8_t *descriptors, uin
 		//rxhead = 0;
 		//rxtail = 0;
 		memset(txbuffer, 0, sizeof(txbuffer));
-		first_update = true;
 		txready = true;
-		updatetimer.start(500000);
+		rxring_head = 0;
+		rxring_tail = 0;
+#if IK_IRQ_BASELINE
+		rx_requeue = 0;
+#endif
 		for (int i = 0; i < 3; i++) {
 			queue_Data_Transfer(rxpipe[i], rxpacket[i], 64, this);
-			rxlen[i] = 0;
 		}
 		do_polling = false;
-		start();
-		return true;
+		poll_again = false;
+		poll_interval = IK_POLL_MIN_US;
+		// Only polled mode needs the timer. The first poll goes out with
+		// the startup commands.
+		if (event_mode == IK_EVENT_MODE_POLLED) {
+			updatetimer.start(poll_interval);
+			poll_again = true;
+		}
+		return CLAIM_RUNNING;
 	}
-	return false;
+	return CLAIM_NONE;
 }
 
-inline int IntelliKeys::PostCommand(uint8_t *command)
+inline int IntelliKeysBase::PostCommand(uint8_t *command)
 {
 	return write(command, IK_REPORT_LEN);
 }
 
-int IntelliKeys::setLED(uint8_t number, uint8_t value)
+int IntelliKeysBase::setLED(uint8_t number, uint8_t value)
 {
 	uint8_t command[IK_REPORT_LEN] = {IK_CMD_LED,number,value,0,0,0,0,0};
 	return PostCommand(command);
 }
 
-int IntelliKeys::sound(int freq, int duration, int volume)
+int IntelliKeysBase::sound(int freq, int duration, int volume)
 {
 	uint8_t report[IK_REPORT_LEN] = {IK_CMD_TONE,0,0,0,0,0,0,0};
 
@@ -142,128 +158,441 @@ int IntelliKeys::sound(int freq, int duration, int volume)
 }
 
 
-int IntelliKeys::get_version(void) {
+int IntelliKeysBase::get_version(void) {
 	uint8_t command[IK_REPORT_LEN] = {IK_CMD_GET_VERSION,0,0,0,0,0,0,0};
-	version_done = false;
 	return PostCommand(command);
 }
 
-int IntelliKeys::get_all_sensors(void) {
+int IntelliKeysBase::get_all_sensors(void) {
 	uint8_t command[IK_REPORT_LEN] = {IK_CMD_ALL_SENSORS,0,0,0,0,0,0,0};
-	memset(sensorStatus, 255, sizeof(sensorStatus));
+	if (sn) sn->sensors.forget();
 	return PostCommand(command);
 }
 
-int IntelliKeys::get_correct(void) {
+int IntelliKeysBase::get_correct(void) {
 	debug_println("get_correct");
+	if (!rs) return 0;
+	rs->correct_report = true;
+	return send_correct();
+}
+
+/*
+ * The IK answers CORRECT commands in order, each with its own run of
+ * CORRECT reports and a CORRECT_DONE. Only the reply to the last command
+ * sent is applied and reported. Replies missing for IK_RESYNC_TIMEOUT_MS
+ * are taken as lost.
+ */
+int IntelliKeysBase::send_correct(void) {
 	uint8_t command[IK_REPORT_LEN] = {IK_CMD_CORRECT,0,0,0,0,0,0,0};
+	if (rs->correct_time >= IK_RESYNC_TIMEOUT_MS) rs->correct_sent = 0;
+	rs->correct_sent++;
+	rs->correct_time = 0;
 	return PostCommand(command);
 }
 
-void IntelliKeys::get_eeprom(void)
+/*
+ * Read the EEPROM with pipelined READBYTE commands. Up to IK_EEPROM_WINDOW
+ * reads are outstanding and each reply frees a slot for the next read, so
+ * the fetch runs as fast as the IK answers. If the IK stops answering for
+ * IK_EEPROM_TIMEOUT_MS, missing bytes are requested again.
+ */
+void IntelliKeysBase::get_eeprom(void)
 {
 	uint8_t report[IK_REPORT_LEN] = {IK_CMD_EEPROM_READBYTE,0,0x1F,0,0,0,0,0};
-	uint8_t pending = 0;
-
-	if (eeprom_period > 64) {
-		debug_println("get_eeprom");
-		eeprom_period = 0;
-		for (uint8_t i=0; i < sizeof(eeprom_t); i++) {
-			if (!eeprom_valid[i]) {
-				report[1] = 0x80 + i;
-				PostCommand(report);
-				if (pending++ > 8) break;
-			}
-		}
-		if (pending == 0) {
-			eeprom_all_valid = true;
-			// Get sensor status events because eeprom_data.sensorBlack and White
-			// now have valid data.
+
+	if (ee->eeprom_count >= sizeof(eeprom_t)) {
+		ee->eeprom_all_valid = true;
+		if (ee->eeprom_read_ms == 0) ee->eeprom_read_ms = connect_time;
+		debug_println("eeprom read ms=", ee->eeprom_read_ms);
+		cal_cache_store();
+		if (sn) {
+			sensor_calibrate(ee->eeprom_data.sensorBlack, ee->eeprom_data.sensorWhite);
+			// Get sensor status events because the calibration now has
+			// valid data.
 			get_all_sensors();
+		}
+
+		if (!ee->SN_reported && ee->on_SN_callback) ee->on_SN_callback(ee->eeprom_data.serialnumber);
+		ee->SN_reported = true;
+		if (sn && sn->cal_state == CAL_VERIFYING) cal_verify();
+		request_complete(IK_REQUEST_EEPROM);
+		return;
+	}
+	if (!ee->cal_cache_checked && ee->cal_cache_addr >= 0) {
+		uint8_t i;
+		for (i = 0; i < IK_EEPROM_SN_SIZE && ee->eeprom_valid[i]; i++) ;
+		if (i == IK_EEPROM_SN_SIZE) cal_cache_load();
+	}
+	if (ee->eeprom_outstanding && ee->eeprom_period > IK_EEPROM_TIMEOUT_MS) {
+		debug_println("get_eeprom timeout");
+		ee->eeprom_outstanding = 0;
+		ee->eeprom_next = 0;
+	}
+	while (ee->eeprom_outstanding < IK_EEPROM_WINDOW) {
+		while (ee->eeprom_next < sizeof(eeprom_t) && ee->eeprom_valid[ee->eeprom_next]) ee->eeprom_next++;
+		if (ee->eeprom_next >= sizeof(eeprom_t)) {
+			// Wait for replies, or go round again for any that were lost.
+			if (ee->eeprom_outstanding) break;
+			ee->eeprom_next = 0;
+			continue;
+		}
+		report[1] = 0x80 + ee->eeprom_next++;
+		PostCommand(report);
+		ee->eeprom_outstanding++;
+		ee->eeprom_period = 0;
+	}
+}
+
+void IntelliKeysBase::clear_eeprom()
+{
+	ee->eeprom_all_valid = false;
+	memset(ee->eeprom_valid, 0, sizeof(ee->eeprom_valid));
+	ee->eeprom_count = 0;
+	ee->eeprom_next = 0;
+	ee->eeprom_outstanding = 0;
+	ee->eeprom_read_ms = 0;
+	ee->cal_cache_checked = false;
+	ee->SN_reported = false;
+}
+
+void IntelliKeysBase::clear_sensors()
+{
+	sn->sensors.reset();
+	sn->calibrated = false;
+	sn->cal_state = CAL_IDLE;
+	sn->cal_cards = 0;
+	sn->overlay_id = sn->overlay_raw = IK_OVERLAY_NONE;
+}
+
+IntelliKeysBase *IntelliKeysBase::cal_cache_writer;
+
+// Address of the valid cache entry for serial, or -1
+int IntelliKeysBase::cal_cache_find(const uint8_t *serial, eeprom_t *cached)
+{
+	for (int i = 0; i < IK_CAL_CACHE_ENTRIES; i++) {
+		int addr = ee->cal_cache_addr + i * cal_cache_entry_size;
+		if (EEPROM.read(addr) != IK_CAL_CACHE_MAGIC) continue;
+		EEPROM.get(addr + 2, *cached);
+		if (memcmp(cached->serialnumber, serial, IK_EEPROM_SN_SIZE) == 0) return addr;
+	}
+	return -1;
+}
+
+/*
+ * The serial number has been read. If it is in the cache, use the cached
+ * calibration until the rest of the EEPROM has been read.
+ */
+void IntelliKeysBase::cal_cache_load(void)
+{
+	eeprom_t cached;
+
+	ee->cal_cache_checked = true;
+	if (cal_cache_find(ee->eeprom_data.serialnumber, &cached) < 0) {
+		debug_println("calibration cache miss");
+		return;
+	}
+	debug_println("calibration cache hit");
+	if (sn) {
+		sensor_calibrate(cached.sensorBlack, cached.sensorWhite);
+		get_all_sensors();
+	}
+	if (ee->on_SN_callback) ee->on_SN_callback(ee->eeprom_data.serialnumber);
+	ee->SN_reported = true;
+}
+
+// The whole IK EEPROM has been read. Have cal_cache_task() save it.
+void IntelliKeysBase::cal_cache_store(void)
+{
+	if (ee->cal_cache_addr >= 0) ee->cal_cache_dirty = true;
+}
+
+/*
+ * Write the cache entry one byte per Task() pass so Task() never blocks
+ * for a whole entry. Only one board writes at a time so two boards never
+ * pick the same slot. The magic byte is cleared first and set last, so an
+ * entry cut short by an unplug or reset is ignored. The entry is not
+ * written at all when it has not changed, and EEPROM.update() skips bytes
+ * that are already right, to save EEPROM wear. A new board takes an empty
+ * slot or else the one written longest ago.
+ */
+void IntelliKeysBase::cal_cache_task(void)
+{
+	if (cal_cache_writer == this) {
+		uint8_t pos = ee->cal_cache_pos++;
+		if (pos < cal_cache_entry_size) {
+			EEPROM.update(ee->cal_cache_write + pos, ee->cal_cache_entry[pos]);
+		} else {
+			EEPROM.update(ee->cal_cache_write, IK_CAL_CACHE_MAGIC);
+			cal_cache_writer = NULL;
+		}
+		return;
+	}
+	if (!ee->cal_cache_dirty || cal_cache_writer) return;
+	ee->cal_cache_dirty = false;
 
-			if (on_SN_callback) (*on_SN_callback)(eeprom_data.serialnumber);
+	int match = -1, empty = -1, oldest = -1;
+	uint8_t oldest_seq = 0, newest_seq = 0;
+	eeprom_t cached;
+	for (int i = 0; i < IK_CAL_CACHE_ENTRIES; i++) {
+		int addr = ee->cal_cache_addr + i * cal_cache_entry_size;
+		if (EEPROM.read(addr) != IK_CAL_CACHE_MAGIC) {
+			if (empty < 0) empty = addr;
+			continue;
+		}
+		uint8_t seq = EEPROM.read(addr + 1);
+		if (oldest < 0) {
+			oldest = addr;
+			oldest_seq = newest_seq = seq;
+		} else {
+			if ((int8_t)(seq - oldest_seq) < 0) {
+				oldest = addr;
+				oldest_seq = seq;
+			}
+			if ((int8_t)(seq - newest_seq) > 0) newest_seq = seq;
+		}
+		EEPROM.get(addr + 2, cached);
+		if (memcmp(cached.serialnumber, ee->eeprom_data.serialnumber, IK_EEPROM_SN_SIZE) == 0) {
+			if (memcmp(&cached, &ee->eeprom_data, sizeof(eeprom_t)) == 0) return;
+			match = addr;
 		}
 	}
+	debug_println("calibration cache write");
+	ee->cal_cache_write = (match >= 0) ? match : (empty >= 0) ? empty : oldest;
+	ee->cal_cache_entry[0] = 0;
+	ee->cal_cache_entry[1] = newest_seq + 1;
+	memcpy(ee->cal_cache_entry + 2, &ee->eeprom_data, sizeof(eeprom_t));
+	ee->cal_cache_pos = 0;
+	cal_cache_writer = this;
+	cal_cache_task();
 }
 
-void IntelliKeys::clear_eeprom()
+// Give up a write cut short by a disconnect. The entry stays invalid.
+void IntelliKeysBase::cal_cache_abort(void)
 {
-	eeprom_all_valid = false;
-	memset(eeprom_valid, 0, sizeof(eeprom_valid));
+	ee->cal_cache_dirty = false;
+	if (cal_cache_writer == this) cal_cache_writer = NULL;
 }
 
-void IntelliKeys::start()
+void IntelliKeysBase::poll_event()
+{
+	uint8_t command[IK_REPORT_LEN] = {IK_CMD_GET_EVENT,0,0,0,0,0,0,0};
+	PostCommand(command);
+}
+
+// Input event seen in polled mode. Keep polling at full speed while the
+// board is busy and drain any queued events right away.
+void IntelliKeysBase::poll_activity()
+{
+	if (event_mode != IK_EVENT_MODE_POLLED) return;
+	poll_again = true;
+	if (poll_interval != IK_POLL_MIN_US) {
+		poll_interval = IK_POLL_MIN_US;
+		updatetimer.start(IK_POLL_MIN_US);
+	}
+}
+
+// Reset the shared state and send the startup commands every feature set
+// needs. IntelliKeysT::start() adds the rest.
+void IntelliKeysBase::start_begin(void)
 {
 	uint8_t command[IK_REPORT_LEN] = {0};
 
 	debug_println("start");
+	connect_time = 0;
+	membrane_state.clear();
+	switches = 0;
+	if (rs) {
+		rs->resync_active = false;
+		rs->correct_report = false;
+		rs->correct_sent = 0;
+		rs->correct_state.clear();
+		rs->correct_switches = 0;
+		rs->correct_seen = 0;
+	}
+	// onVersion fires once per connect, for the first reply
+	version_done = false;
 	command[0] = IK_CMD_INIT;
-	command[1] = 0;  //  interrupt event mode
+	command[1] = event_mode;
 	PostCommand(command);
 
 	command[0] = IK_CMD_SCAN;
 	command[1] = 1;	//  enable
 	PostCommand(command);
 
-	//delay(250);
-
-	get_all_sensors();
+	// Everything from here on is in flight at once. Membrane state goes
+	// first to pick up anything already pressed when the IK was plugged
+	// in, then the version and the first EEPROM reads. The sensors are read
+	// with default thresholds now and again once the calibration is known.
+	resync();
 
 	get_version();
+}
 
-	clear_eeprom();
+void IntelliKeysBase::start_end(void)
+{
+	starting = true;
+	is_ready = false;
+	ready_ms = 0;
+	startup_retry = 0;
 
-	if (connect_callback) (*connect_callback)();
+	if (connect_callback) connect_callback();
 }
 
-void IntelliKeys::disconnect()
+/*
+ * Fire onReady once every startup reply is in. Replies lost on the way are
+ * asked for again every IK_RESYNC_TIMEOUT_MS.
+ */
+void IntelliKeysBase::startup_task(void)
 {
-	updatetimer.stop();
-	//txtimer.stop();
+	bool sensors_known = true;
+	bool calibrated = true;
 
-	if (disconnect_callback) (*disconnect_callback)();
+	if (sn) {
+		for (int i = 0; i < IK_NUM_SENSORS; i++) {
+			if (sn->sensors.state(i) == IK_SENSOR_UNKNOWN) sensors_known = false;
+		}
+		// Without the EEPROM the default thresholds are all there is
+		if (ee) calibrated = sn->calibrated;
+	}
+	if (version_done && !(rs && rs->resync_active) && calibrated && sensors_known) {
+		starting = false;
+		is_ready = true;
+		ready_ms = connect_time;
+		debug_println("ready ms=", ready_ms);
+		if (ready_callback) ready_callback();
+		return;
+	}
+	if (startup_retry < IK_RESYNC_TIMEOUT_MS) return;
+	startup_retry = 0;
+	if (!version_done) get_version();
+	if (rs && rs->resync_active) resync();
+	if (!sensors_known) get_all_sensors();
 }
 
-
-void IntelliKeys::rx_callback1(const Transfer_t *transfer)
+void IntelliKeysBase::rx_callback1(const Transfer_t *transfer)
 {
 	if (!transfer->driver) return;
-	((IntelliKeys *)(transfer->driver))->rx_data(0, transfer);
+	((IntelliKeysBase *)(transfer->driver))->rx_data(0, transfer);
 }
 
-void IntelliKeys::rx_callback3(const Transfer_t *transfer)
+void IntelliKeysBase::rx_callback3(const Transfer_t *transfer)
 {
 	if (!transfer->driver) return;
-	((IntelliKeys *)(transfer->driver))->rx_data(1, transfer);
+	((IntelliKeysBase *)(transfer->driver))->rx_data(1, transfer);
 }
 
-void IntelliKeys::rx_callback4(const Transfer_t *transfer)
+void IntelliKeysBase::rx_callback4(const Transfer_t *transfer)
 {
 	if (!transfer->driver) return;
-	((IntelliKeys *)(transfer->driver))->rx_data(2, transfer);
+	((IntelliKeysBase *)(transfer->driver))->rx_data(2, transfer);
 }
 
-void IntelliKeys::tx_callback(const Transfer_t *transfer)
+void IntelliKeysBase::tx_callback(const Transfer_t *transfer)
 {
 	if (!transfer->driver) return;
-	((IntelliKeys *)(transfer->driver))->tx_data(transfer);
+	((IntelliKeysBase *)(transfer->driver))->tx_data(transfer);
 }
 
-void IntelliKeys::rx_data(uint8_t idx, const Transfer_t *transfer)
+/*
+ * Runs in the USB host interrupt. Copy the report into rxring and give the
+ * buffer straight back to the host controller. rx_data only writes
+ * rxring_head and Task() only writes rxring_tail so no locking is needed.
+ */
+void IntelliKeysBase::rx_data(uint8_t idx, const Transfer_t *transfer)
 {
+	uint32_t start_cycles = ARM_DWT_CYCCNT;
 	uint32_t len = transfer->length - ((transfer->qtd.token >> 16) & 0x7FFF);
 	//print_hexbytes(transfer->buffer, len);
-	if (len < 1 || len > 64) {
-		queue_Data_Transfer(rxpipe[idx], rxpacket[idx], 64, this);
-		rxlen[idx] = 0;
-	} else {
-		rxlen[idx] = len;
-		// TODO: should someday use EventResponder to call from yield()
+	if (idx == 0 && len >= 1 && len <= 64) {
+		uint32_t head = rxring_head;
+		uint32_t next = (head + 1) & (IK_RX_RING_SIZE - 1);
+		if (next == rxring_tail) {
+			irq_stats.rx_overruns++;
+		} else {
+			if (len > IK_REPORT_LEN) len = IK_REPORT_LEN;
+			memcpy(rxring[head], rxpacket[idx], len);
+			rxring_len[head] = len;
+			rxring_time[head] = millis();
+			// Slot contents must be stored before the head moves
+			__asm__ volatile("" ::: "memory");
+			rxring_head = next;
+			// Only reports Task() will also see, so both paths agree
+			if (len >= 3) fast_path(rxpacket[idx]);
+		}
+	}
+#if IK_IRQ_BASELINE
+	rx_requeue |= 1 << idx;
+#else
+	queue_Data_Transfer(rxpipe[idx], rxpacket[idx], 64, this);
+#endif
+	irq_stats_update(start_cycles);
+}
+
+#if IK_IRQ_BASELINE
+// The old hand-off, for comparison only. The masked section is counted
+// like interrupt time because it holds off the USB host interrupt too.
+void IntelliKeysBase::rx_requeue_masked(void)
+{
+	for (uint8_t i = 0; i < 3; i++) {
+		if (!(rx_requeue & (1 << i))) continue;
+		uint32_t start_cycles = ARM_DWT_CYCCNT;
+		NVIC_DISABLE_IRQ(IRQ_USBHS);
+		rx_requeue &= ~(1 << i);
+		queue_Data_Transfer(rxpipe[i], rxpacket[i], 64, this);
+		irq_stats_update(start_cycles);
+		NVIC_ENABLE_IRQ(IRQ_USBHS);
 	}
 }
+#endif
 
-void IntelliKeys::tx_data(const Transfer_t *transfer)
+// Interrupt context, see onMembraneISR()
+void IntelliKeysBase::fast_path(const uint8_t *report)
 {
+	switch (report[0]) {
+		case IK_EVENT_MEMBRANE_PRESS:
+			if (membrane_isr_callback) (*membrane_isr_callback)(report[1], report[2], 1);
+			break;
+		case IK_EVENT_MEMBRANE_RELEASE:
+			if (membrane_isr_callback) (*membrane_isr_callback)(report[1], report[2], 0);
+			break;
+		case IK_EVENT_SWITCH:
+			if (switch_isr_callback) (*switch_isr_callback)(report[1], report[2]);
+			break;
+		default:
+			break;
+	}
+}
+
+void IntelliKeysBase::irq_stats_update(uint32_t start_cycles)
+{
+	uint32_t cycles = ARM_DWT_CYCCNT - start_cycles;
+	irq_stats.count++;
+	irq_stats.total_cycles += cycles;
+	if (cycles > irq_stats.max_cycles) irq_stats.max_cycles = cycles;
+}
+
+void IntelliKeysBase::getIrqStats(ik_irq_stats_t *stats)
+{
+	// Retry if an interrupt updated the counters while copying.
+	do {
+		stats->count = irq_stats.count;
+		stats->max_cycles = irq_stats.max_cycles;
+		stats->total_cycles = irq_stats.total_cycles;
+		stats->rx_overruns = irq_stats.rx_overruns;
+	} while (stats->count != irq_stats.count);
+}
+
+void IntelliKeysBase::clearIrqStats(void)
+{
+	irq_stats.max_cycles = 0;
+	irq_stats.total_cycles = 0;
+	irq_stats.rx_overruns = 0;
+	irq_stats.count = 0;
+}
+
+void IntelliKeysBase::tx_data(const Transfer_t *transfer)
+{
+	uint32_t start_cycles = ARM_DWT_CYCCNT;
 	uint8_t *p = (uint8_t *)transfer->buffer;
 	//debug_print("tx_data, len=", *(p-1));
 	//debug_print(", tail=", (p-1) - txbuffer);
@@ -279,10 +608,11 @@ void IntelliKeys::tx_data(const Transfer_t *transfer)
 	//txtimer.start(8000);
 	// adjust tail...
 	// start timer if more data to send
+	irq_stats_update(start_cycles);
 }
 
 
-size_t IntelliKeys::write(const void *data, const size_t size)
+size_t IntelliKeysBase::write(const void *data, const size_t size)
 {
 	//debug_print("write ", size);
 	//debug_print(" bytes: ");
@@ -315,7 +645,7 @@ size_t IntelliKeys::write(const void *data, const size_t size)
 	return size;
 }
 
-void IntelliKeys::transmit()
+void IntelliKeysBase::transmit()
 {
 	if (!txready) return;
 	uint32_t head = txhead;
@@ -329,7 +659,9 @@ void IntelliKeys::transmit()
 	//debug_print("tail=", tail);
 	//debug_println(", tx size=", size);
 	if (size == 0xFF) {
-		txtail = 0;
+		// The report starts at 0 so tx_data() must see the tail just
+		// before it.
+		txtail = sizeof(txbuffer) - 1;
 		tail = 0;
 		size = txbuffer[0];
 		//debug_println("tx size=", size);
@@ -340,29 +672,82 @@ void IntelliKeys::transmit()
 	txready = false;
 }
 
-void IntelliKeys::timer_event(USBDriverTimer *whichTimer)
+bool IntelliKeysBase::repeatStart(uint8_t id, uint16_t delay_ms, uint16_t rate_ms)
 {
-#if 1
-	if (whichTimer == &updatetimer) {
-		updatetimer.start(250000);
-		if (first_update) {
-			//ResetSystem();
-			first_update = false;
-		} else {
-			do_polling = true;
+	repeat_t *free_slot = NULL;
+
+	if (!rp || rate_ms == 0) return false;
+	for (int i = 0; i < IK_REPEAT_MAX; i++) {
+		repeat_t *r = &rp->repeats[i];
+		if (r->active && r->id == id) return true;
+		if (!r->active && !free_slot) free_slot = r;
+	}
+	if (!free_slot) return false;
+	free_slot->id = id;
+	free_slot->rate = rate_ms;
+	free_slot->next = millis() + delay_ms;
+	free_slot->fired = 0;
+	free_slot->delivered = 0;
+	free_slot->active = true;
+	repeattimer.start(1000);
+	return true;
+}
+
+void IntelliKeysBase::repeatStop(uint8_t id)
+{
+	if (!rp) return;
+	for (int i = 0; i < IK_REPEAT_MAX; i++) {
+		if (rp->repeats[i].active && rp->repeats[i].id == id) rp->repeats[i].active = false;
+	}
+}
+
+void IntelliKeysBase::repeatStopAll(void)
+{
+	if (!rp) return;
+	repeattimer.stop();
+	for (int i = 0; i < IK_REPEAT_MAX; i++) rp->repeats[i].active = false;
+}
+
+/*
+ * Interrupt context. Count due repeats and sleep until the next one. The
+ * next deadline is advanced from the previous deadline, not from now, so the
+ * rate does not drift.
+ */
+void IntelliKeysBase::repeat_timer(void)
+{
+	uint32_t now = millis();
+	uint32_t sleep = 0;
+	bool any = false;
+
+	for (int i = 0; i < IK_REPEAT_MAX; i++) {
+		repeat_t *r = &rp->repeats[i];
+		if (!r->active) continue;
+		if ((int32_t)(now - r->next) >= 0) {
+			r->fired++;
+			r->next += r->rate;
+			// Fell far behind, resync rather than burst.
+			if ((int32_t)(now - r->next) >= 0) r->next = now + r->rate;
 		}
-		//debug_println("ant update timer");
+		uint32_t wait = r->next - now;
+		if (!any || wait < sleep) sleep = wait;
+		any = true;
 	}
-	/* else if (whichTimer == &txtimer) {
-	   debug_println("ant tx timer");
-	//txtimer.stop(); // TODO: why is this needed?
-	txready = true;
-	transmit();
-	} */
-#endif
+	if (any) repeattimer.start((sleep ? sleep : 1) * 1000);
 }
 
-void IntelliKeys::ezusb_8051Reset(uint8_t resetBit)
+void IntelliKeysBase::repeat_task(void)
+{
+	for (int i = 0; i < IK_REPEAT_MAX; i++) {
+		repeat_t *r = &rp->repeats[i];
+		uint8_t fired = r->fired;
+		while (r->delivered != fired) {
+			r->delivered++;
+			if (r->active && rp->repeat_callback) rp->repeat_callback(r->id);
+		}
+	}
+}
+
+void IntelliKeysBase::ezusb_8051Reset(uint8_t resetBit)
 {
 	static uint8_t reg_value;
 	debug_println("Ezusb_8051Reset");
@@ -374,7 +759,7 @@ void IntelliKeys::ezusb_8051Reset(uint8_t resetBit)
 static PINTEL_HEX_RECORD pHex;
 static uint8_t pHexBuf[MAX_INTEL_HEX_RECORD_LENGTH];
 
-int IntelliKeys::ezusb_DownloadIntelHex(bool internal)
+int IntelliKeysBase::ezusb_DownloadIntelHex(bool internal)
 {
 	while (pHex->Type == 0) {
 		debug_print("pHex="); debug_println((uint32_t)pHex, HEX);
@@ -393,7 +778,7 @@ int IntelliKeys::ezusb_DownloadIntelHex(bool internal)
 	return 1;
 }
 
-void IntelliKeys::IK_firmware_load()
+void IntelliKeysBase::IK_firmware_load()
 {
 	while (1) {
 		switch (IK_state)
@@ -468,7 +853,7 @@ void IntelliKeys::IK_firmware_load()
 	}
 }
 
-void IntelliKeys::control(const Transfer_t *transfer)
+void IntelliKeysBase::control_log(const Transfer_t *transfer)
 {
 	debug_println("control callback (IntelliKeys)");
 	print_hexbytes(transfer->buffer, transfer->length);
@@ -476,96 +861,418 @@ void IntelliKeys::control(const Transfer_t *transfer)
 	//   http://eleccelerator.com/usbdescreqparser/
 	uint32_t mesg = transfer->setup.word1;
 	debug_println("  mesg = ", mesg, HEX);
-	if (IK_state != 1) IK_firmware_load();
 }
 
-void IntelliKeys::sensorUpdate(int sensor, int value)
+bool IntelliKeysBase::calibrateSensors(uint8_t card)
+{
+	if (!sn || sn->cal_state != CAL_IDLE || card > IK_CAL_BLACK) return false;
+	sn->cal_state = CAL_SAMPLING;
+	sn->cal_card = card;
+	sn->cal_passes = 0;
+	sn->cal_seen = 0;
+	memset(sn->cal_sum, 0, sizeof(sn->cal_sum));
+	sn->cal_time = 0;
+	get_all_sensors();
+	return true;
+}
+
+// Raw sensor value while a reference card is being sampled
+void IntelliKeysBase::cal_sample(int sensor, int value)
+{
+	if (sensor < 0 || sensor >= IK_NUM_SENSORS || (sn->cal_seen & (1 << sensor))) return;
+	sn->cal_sum[sensor] += value;
+	sn->cal_seen |= 1 << sensor;
+	if (sn->cal_seen != (1 << IK_NUM_SENSORS) - 1) return;
+	sn->cal_seen = 0;
+	sn->cal_time = 0;
+	if (++sn->cal_passes < IK_CAL_SAMPLES) {
+		get_all_sensors();
+		return;
+	}
+	uint8_t *level = (sn->cal_card == IK_CAL_WHITE) ? sn->cal_white : sn->cal_black;
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		level[i] = (sn->cal_sum[i] + IK_CAL_SAMPLES/2) / IK_CAL_SAMPLES;
+	}
+	sn->cal_cards |= 1 << sn->cal_card;
+	cal_done(sn->cal_card, true);
+}
+
+bool IntelliKeysBase::calibrationWrite(void)
+{
+#if !IK_EXPERIMENTAL_EEPROM_WRITE
+	debug_println("calibrationWrite needs IK_EXPERIMENTAL_EEPROM_WRITE");
+	return false;
+#endif
+	if (!sn || !ee || sn->cal_state != CAL_IDLE || !ee->eeprom_all_valid ||
+			sn->cal_cards != ((1 << IK_CAL_WHITE) | (1 << IK_CAL_BLACK))) {
+		return false;
+	}
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		int span = sn->cal_white[i] - sn->cal_black[i];
+		if (span < 0) span = -span;
+		if (span < IK_SENSOR_MIN_SPAN) {
+			debug_println("calibration span too small, sensor=", i);
+			cal_done(IK_CAL_WRITE, false);
+			return true;
+		}
+	}
+	memcpy(ee->eeprom_data.sensorBlack, sn->cal_black, sizeof(sn->cal_black));
+	memcpy(ee->eeprom_data.sensorWhite, sn->cal_white, sizeof(sn->cal_white));
+	sn->cal_state = CAL_WRITING;
+	sn->cal_pending = (1 << (2*IK_NUM_SENSORS)) - 1;
+	sn->cal_tries = 0;
+	sn->cal_time = IK_EEPROM_WRITE_MS;
+	return true;
+}
+
+/*
+ * One EEPROM byte write per IK_EEPROM_WRITE_MS so the IK has time to
+ * finish each write and the TX queue never fills. Once the batch is out
+ * the bytes are read back through the normal EEPROM read pipeline.
+ */
+void IntelliKeysBase::cal_task(void)
+{
+	const uint8_t first = offsetof(eeprom_t, sensorBlack);
+	uint8_t report[IK_REPORT_LEN] = {IK_CMD_EEPROM_WRITE,0,0x1F,0,0,0,0,0};
+
+	if (sn->cal_state == CAL_SAMPLING) {
+		if (sn->cal_time < IK_RESYNC_TIMEOUT_MS) return;
+		debug_println("calibration sample timeout");
+		cal_done(sn->cal_card, false);
+		return;
+	}
+	if (sn->cal_state != CAL_WRITING || sn->cal_time < IK_EEPROM_WRITE_MS) return;
+	sn->cal_time = 0;
+	if (sn->cal_pending) {
+		int bit = __builtin_ctz(sn->cal_pending);
+		sn->cal_pending &= ~(1 << bit);
+		// Guessed layout, see IK_EXPERIMENTAL_EEPROM_WRITE: address as for
+		// READBYTE, 0x1F80 + offset low byte first, then the data.
+		// extras/host_test models the same guess so it cannot confirm it.
+		report[1] = 0x80 + first + bit;
+		report[3] = ((uint8_t *)&ee->eeprom_data)[first + bit];
+		PostCommand(report);
+		return;
+	}
+	// Read the batch back
+	sn->cal_state = CAL_VERIFYING;
+	for (int i = 0; i < 2*IK_NUM_SENSORS; i++) ee->eeprom_valid[first + i] = false;
+	ee->eeprom_count -= 2*IK_NUM_SENSORS;
+	ee->eeprom_all_valid = false;
+}
+
+// The calibration bytes have been read back. Write any that differ again.
+void IntelliKeysBase::cal_verify(void)
+{
+	sn->cal_pending = 0;
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		if (ee->eeprom_data.sensorBlack[i] != sn->cal_black[i]) sn->cal_pending |= 1 << i;
+		if (ee->eeprom_data.sensorWhite[i] != sn->cal_white[i]) sn->cal_pending |= 1 << (IK_NUM_SENSORS + i);
+	}
+	if (sn->cal_pending == 0) {
+		cal_done(IK_CAL_WRITE, true);
+		return;
+	}
+	debug_println("calibration verify failed, bytes=", sn->cal_pending, HEX);
+	if (++sn->cal_tries >= IK_CAL_RETRIES) {
+		cal_done(IK_CAL_WRITE, false);
+		return;
+	}
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		ee->eeprom_data.sensorBlack[i] = sn->cal_black[i];
+		ee->eeprom_data.sensorWhite[i] = sn->cal_white[i];
+	}
+	sn->cal_state = CAL_WRITING;
+	sn->cal_time = IK_EEPROM_WRITE_MS;
+}
+
+void IntelliKeysBase::cal_done(int step, bool ok)
+{
+	sn->cal_state = CAL_IDLE;
+	if (step != IK_CAL_WRITE) {
+		// Back to normal sensor reporting
+		get_all_sensors();
+	}
+	if (sn->calibration_callback) sn->calibration_callback(step, ok);
+}
+
+void IntelliKeysBase::sensor_calibrate(const uint8_t *black, const uint8_t *white)
+{
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		sn->sensors.calibrate(i, black[i], white[i]);
+	}
+	sn->calibrated = true;
+}
+
+void IntelliKeysBase::sensorUpdate(int sensor, int value)
+{
+	if (sn->cal_state == CAL_SAMPLING) {
+		cal_sample(sensor, value);
+		return;
+	}
+	int sensorOn = sn->sensors.update(sensor, value);
+
+	if (sensorOn < 0) return;
+	if (sn->sensor_callback) sn->sensor_callback(sensor, sensorOn);
+	if (eb && eb->events_callback) event_add(IK_EVENT_SENSOR_CHANGE, sensor, sensorOn);
+
+	int id = 0;
+	for (int i = 0; i < IK_NUM_SENSORS; i++) {
+		uint8_t state = sn->sensors.state(i);
+		// Keep the last ID while get_all_sensors refreshes the states
+		if (state == IK_SENSOR_UNKNOWN) return;
+		id |= state << i;
+	}
+	if (id != sn->overlay_raw) {
+		sn->overlay_raw = id;
+		sn->overlay_time = 0;
+	}
+}
+
+// The sensor bits change one at a time while an overlay slides in so only
+// pass on an ID that has held still for overlay_settle ms.
+void IntelliKeysBase::overlay_task(void)
+{
+	if (sn->overlay_raw == sn->overlay_id || sn->overlay_time < sn->overlay_settle) return;
+	sn->overlay_id = sn->overlay_raw;
+	debug_println("overlay=", sn->overlay_id);
+	if (sn->overlay_callback) sn->overlay_callback(sn->overlay_id);
+}
+
+void IntelliKeysBase::membrane_press(int x, int y)
+{
+	if (IKBitmap::valid(x, y)) membrane_state.set(x, y);
+	if (membrane_press_callback) membrane_press_callback(x, y);
+	if (eb && eb->events_callback) event_add(IK_EVENT_MEMBRANE_PRESS, x, y);
+}
+
+void IntelliKeysBase::membrane_release(int x, int y)
+{
+	if (IKBitmap::valid(x, y)) membrane_state.reset(x, y);
+	if (membrane_release_callback) membrane_release_callback(x, y);
+	if (eb && eb->events_callback) event_add(IK_EVENT_MEMBRANE_RELEASE, x, y);
+}
+
+void IntelliKeysBase::switch_update(int switch_number, int switch_state)
+{
+	if (switch_number >= 0 && switch_number < 16) {
+		if (switch_state) {
+			switches |= (1 << switch_number);
+		} else {
+			switches &= ~(1 << switch_number);
+		}
+	}
+	if (switch_callback) switch_callback(switch_number, switch_state);
+	if (eb && eb->events_callback) event_add(IK_EVENT_SWITCH, switch_number, switch_state);
+}
+
+void IntelliKeysBase::event_add(uint8_t type, uint8_t x, uint8_t y)
 {
-	int midpoint = 150;
+	ik_event_t &e = eb->events[eb->events_count];
+	e.time = event_time;
+	e.type = type;
+	e.x = x;
+	e.y = y;
+	if (++eb->events_count >= IK_EVENT_BATCH) events_flush();
+}
 
-	if (eeprom_all_valid) {
-		midpoint = (50*eeprom_data.sensorBlack[sensor] +
-			50*eeprom_data.sensorWhite[sensor]) / 100;
+void IntelliKeysBase::events_flush(void)
+{
+	uint8_t count = eb->events_count;
+	eb->events_count = 0;
+	if (eb->events_callback) eb->events_callback(eb->events, count);
+}
+
+/*
+ * Ask the IK for its current membrane and switch state. When the CORRECT
+ * report is done, resync_apply() sends release and press events for the
+ * cells and switches that differ from what the sketch has been told. A
+ * resync already waiting for its reply is left to finish.
+ */
+void IntelliKeysBase::resync(void)
+{
+	if (!rs) return;
+	if (rs->resync_active && rs->resync_time < IK_RESYNC_TIMEOUT_MS) return;
+	rs->resync_active = true;
+	rs->resync_time = 0;
+	send_correct();
+}
+
+void IntelliKeysBase::resync_apply(void)
+{
+	IKBitmap pressed, released;
+
+	rs->resync_active = false;
+	rs->resync_time = 0;
+	if (IKBitmap::diff(membrane_state, rs->correct_state, &pressed, &released)) {
+		debug_println("resync membrane");
+		// Releases first so stuck keys clear before new presses.
+		for (int y = 0; y < IK_RESOLUTION_Y; y++) {
+			uint32_t bits = released.row_bits(y);
+			while (bits) {
+				int x = __builtin_ctz(bits);
+				bits &= bits - 1;
+				if (debounce) debounce->set(IKBitmap::cell(x, y), false);
+				membrane_release(x, y);
+			}
+		}
+		for (int y = 0; y < IK_RESOLUTION_Y; y++) {
+			uint32_t bits = pressed.row_bits(y);
+			while (bits) {
+				int x = __builtin_ctz(bits);
+				bits &= bits - 1;
+				if (debounce) debounce->set(IKBitmap::cell(x, y), true);
+				membrane_press(x, y);
+			}
+		}
+	}
+	uint16_t changed = switches ^ rs->correct_switches;
+	while (changed) {
+		int n = __builtin_ctz(changed);
+		changed &= changed - 1;
+		switch_update(n, (rs->correct_switches >> n) & 1);
+	}
+}
+
+// Hand the finished CORRECT reply to the onCorrect... callbacks
+void IntelliKeysBase::correct_done(void)
+{
+	rs->correct_report = false;
+	if (rs->correct_membrane_callback) {
+		for (int y = 0; y < IK_RESOLUTION_Y; y++) {
+			uint32_t bits = rs->correct_state.row_bits(y);
+			while (bits) {
+				int x = __builtin_ctz(bits);
+				bits &= bits - 1;
+				rs->correct_membrane_callback(x, y);
+			}
+		}
+	}
+	if (rs->correct_switch_callback) {
+		uint16_t seen = rs->correct_seen;
+		while (seen) {
+			int n = __builtin_ctz(seen);
+			seen &= seen - 1;
+			rs->correct_switch_callback(n, (rs->correct_switches >> n) & 1);
+		}
 	}
-	int sensorOn = (value > midpoint);
-	if (sensorStatus[sensor] != sensorOn) {
-		if (sensor_callback) (*sensor_callback)(sensor, sensorOn);
-		sensorStatus[sensor] = sensorOn;
+	if (rs->correct_done_callback) rs->correct_done_callback();
+}
+
+// Pass on presses and releases that have outlasted their debounce window
+void IntelliKeysBase::debounce_task(void)
+{
+	int cell;
+	int event;
+
+	while ((event = debounce->poll(millis(), &cell)) != IK_DEBOUNCE_NONE) {
+		int x = cell % IK_RESOLUTION_X;
+		int y = cell / IK_RESOLUTION_X;
+		if (event == IK_DEBOUNCE_PRESS) {
+			membrane_press(x, y);
+		} else {
+			membrane_release(x, y);
+		}
 	}
 }
 
-void IntelliKeys::handleEvents(const uint8_t *rxpacket, size_t len)
+void IntelliKeysBase::membrane_repeat(int x, int y)
+{
+	debug_println("IK_EVENT_MEMBRANE_REPEAT");
+	if (membrane_repeat_callback) membrane_repeat_callback(x, y);
+	if (eb && eb->events_callback) event_add(IK_EVENT_MEMBRANE_REPEAT, x, y);
+}
+
+void IntelliKeysBase::switch_repeat(int switch_number)
 {
-	if ((rxpacket == NULL) || (len == 0)) return;
+	debug_println("IK_EVENT_SWITCH_REPEAT");
+	if (switch_repeat_callback) switch_repeat_callback(switch_number);
+	if (eb && eb->events_callback) event_add(IK_EVENT_SWITCH_REPEAT, switch_number, 1);
+}
+
+void IntelliKeysBase::eeprom_byte(uint8_t addr, uint8_t value)
+{
+	debug_println("IK_EVENT_EEPROM_READBYTE");
+	uint8_t idx = addr - 0x80;
+	if (ee->eeprom_outstanding) ee->eeprom_outstanding--;
+	ee->eeprom_period = 0;
+	if (idx >= sizeof(eeprom_t)) return;
+	uint8_t *p = (uint8_t *)&ee->eeprom_data;
+	p[idx] = value;
+	if (!ee->eeprom_valid[idx]) ee->eeprom_count++;
+	ee->eeprom_valid[idx] = true;
+}
 
+// Reports every feature set handles. IntelliKeysT::handleEvents() takes the
+// membrane, switch, sensor and EEPROM reports.
+void IntelliKeysBase::handle_common(const uint8_t *rxpacket)
+{
 	switch (*rxpacket) {
 		case IK_EVENT_ACK:
 			//debug_println("IK_EVENT_ACK");
 			break;
-		case IK_EVENT_MEMBRANE_PRESS:
-			debug_printf("IK_EVENT_MEMBRANE_PRESS=(%d,%d)", rxpacket[1], rxpacket[2]);
-			if(membrane_press_callback) (*membrane_press_callback)(rxpacket[1], rxpacket[2]);
-			break;
-		case IK_EVENT_MEMBRANE_RELEASE:
-			debug_printf("IK_EVENT_MEMBRANE_RELEASE=(%d,%d)", rxpacket[1], rxpacket[2]);
-			if (membrane_release_callback) (*membrane_release_callback)(rxpacket[1], rxpacket[2]);
-			break;
-		case IK_EVENT_SWITCH:
-			debug_printf("IK_EVENT_SWITCH switch[%d]=%d", rxpacket[1], rxpacket[2]);
-			if (switch_callback) (*switch_callback)(rxpacket[1], rxpacket[2]);
-			break;
-		case IK_EVENT_SENSOR_CHANGE:
-			//debug_printf("IK_EVENT_SENSOR_CHANGE sensor[%d]=%d", rxpacket[1], rxpacket[2]);
-			sensorUpdate(rxpacket[1], rxpacket[2]);
-			break;
 		case IK_EVENT_VERSION:
 			debug_printf("IK_EVENT_VERSION= %d.%d", rxpacket[1], rxpacket[2]);
-			if (!version_done && version_callback) (*version_callback)(rxpacket[1], rxpacket[2]);
+			if (!version_done && version_callback) version_callback(rxpacket[1], rxpacket[2]);
 			version_done = true;
+			version_major = rxpacket[1];
+			version_minor = rxpacket[2];
+			request_complete(IK_REQUEST_VERSION);
 			break;
 		case IK_EVENT_EEPROM_READ:
 			debug_println("IK_EVENT_EEPROM_READ");
 			break;
 		case IK_EVENT_ONOFFSWITCH:
+			poll_activity();
 			debug_printf("IK_EVENT_ONOFFSWITCH= %d", rxpacket[1]);
-			if (on_off_callback) {
-				if (rxpacket[1]) {
-					get_correct();
-					get_all_sensors();
-				}
-				(*on_off_callback)(rxpacket[1]);
+			if (rxpacket[1]) {
+				resync();
+				if (sn) get_all_sensors();
 			}
+			if (on_off_callback) on_off_callback(rxpacket[1]);
+			if (eb && eb->events_callback) event_add(IK_EVENT_ONOFFSWITCH, rxpacket[1], 0);
 			break;
 		case IK_EVENT_NOMOREEVENTS:
 			debug_println("IK_EVENT_NOMOREEVENTS");
-			break;
-		case IK_EVENT_MEMBRANE_REPEAT:
-			debug_println("IK_EVENT_MEMBRANE_REPEAT");
-			break;
-		case IK_EVENT_SWITCH_REPEAT:
-			debug_println("IK_EVENT_SWITCH_REPEAT");
+			// Idle, back off.
+			if (poll_interval < IK_POLL_MAX_US) {
+				uint32_t interval = poll_interval * 2;
+				if (interval > IK_POLL_MAX_US) interval = IK_POLL_MAX_US;
+				poll_interval = interval;
+			}
 			break;
 		case IK_EVENT_CORRECT_MEMBRANE:
 			debug_printf("IK_EVENT_CORRECT_MEMBRANE (%d,%d)", rxpacket[1], rxpacket[2]);
-			if (correct_membrane_callback) (*correct_membrane_callback)(rxpacket[1], rxpacket[2]);
+			if (!rs) break;
+			rs->correct_time = 0;
+			if (IKBitmap::valid(rxpacket[1], rxpacket[2])) {
+				rs->correct_state.set(rxpacket[1], rxpacket[2]);
+			}
 			break;
 		case IK_EVENT_CORRECT_SWITCH:
 			debug_printf("IK_EVENT_CORRECT_SWITCH switch[%d]=%d",
 					rxpacket[1], rxpacket[2]);
-			if (correct_switch_callback) (*correct_switch_callback)(rxpacket[1], rxpacket[2]);
+			if (!rs) break;
+			rs->correct_time = 0;
+			if (rxpacket[1] < 16) {
+				rs->correct_seen |= (1 << rxpacket[1]);
+				if (rxpacket[2]) rs->correct_switches |= (1 << rxpacket[1]);
+			}
 			break;
 		case IK_EVENT_CORRECT_DONE:
 			debug_println("IK_EVENT_CORRECT_DONE");
-			if (correct_done_callback) (*correct_done_callback)();
-			break;
-		case IK_EVENT_EEPROM_READBYTE:
-			debug_println("IK_EVENT_EEPROM_READBYTE");
-			{
-				uint8_t idx = rxpacket[2] - 0x80;
-				uint8_t *p = (uint8_t *)&eeprom_data;
-				p[idx] = rxpacket[1];
-				eeprom_valid[idx] = true;
+			if (!rs) break;
+			rs->correct_time = 0;
+			if (rs->correct_sent) rs->correct_sent--;
+			// The reply to an earlier command is dropped, a newer one follows
+			if (!rs->correct_sent) {
+				if (rs->resync_active) resync_apply();
+				if (rs->correct_report) correct_done();
+				request_complete(IK_REQUEST_CORRECT);
 			}
+			rs->correct_state.clear();
+			rs->correct_switches = 0;
+			rs->correct_seen = 0;
 			break;
 		case IK_EVENT_DEVICEREADY:
 			debug_println("IK_EVENT_DEVICEREADY");
@@ -578,6 +1285,7 @@ void IntelliKeys::handleEvents(const uint8_t *rxpacket, size_t len)
 			break;
 		case IK_EVENT_ALL_SENSORS:
 			debug_println("IK_EVENT_ALL_SENSORS");
+			request_complete(IK_REQUEST_SENSORS);
 			break;
 		default:
 			debug_printf("Unknown event code=%d\n", *rxpacket);
@@ -585,24 +1293,133 @@ void IntelliKeys::handleEvents(const uint8_t *rxpacket, size_t len)
 	}
 }
 
-void IntelliKeys::Task()
+ik_request_t IntelliKeysBase::request(uint8_t type, const IKDelegate<ik_request_t, int> &done,
+		uint16_t timeout_ms, uint8_t retries)
 {
-	if (IK_state == 2) IK_firmware_load();
+	request_t *r = NULL;
 
-	for (int i = 0; i < 3; i++) {
-		uint32_t len = rxlen[i];
-		if (len) {
-			if (i == 0) handleEvents(rxpacket[i], len);
-			NVIC_DISABLE_IRQ(IRQ_USBHS);
-			queue_Data_Transfer(rxpipe[i], rxpacket[i], 64, this);
-			rxlen[i] = 0;
-			NVIC_ENABLE_IRQ(IRQ_USBHS);
+	if (!rq || type > IK_REQUEST_EEPROM) return -1;
+	if ((type == IK_REQUEST_SENSORS && !sn) || (type == IK_REQUEST_EEPROM && !ee)) return -1;
+	if (type == IK_REQUEST_CORRECT && !rs) return -1;
+	// Prefer a slot never used, then the one that finished longest ago
+	for (int i = 0; i < IK_REQUEST_MAX; i++) {
+		request_t &slot = rq->requests[i];
+		if (slot.status == IK_REQUEST_PENDING) continue;
+		if (slot.status == IK_REQUEST_NONE) {
+			r = &slot;
+			break;
+		}
+		if (!r || (uint16_t)(rq->request_seq - slot.seq) > (uint16_t)(rq->request_seq - r->seq)) {
+			r = &slot;
+		}
+	}
+	if (!r) return -1;
+	// Sequence numbers fit in 11 bits so handles stay positive
+	rq->request_seq = (rq->request_seq + 1) & 0x7FF;
+	r->seq = rq->request_seq;
+	r->type = type;
+	r->timeout = timeout_ms;
+	r->retries = retries;
+	r->done = done;
+	r->status = IK_REQUEST_PENDING;
+	rq->requests_pending++;
+	request_send(*r);
+	return (r->seq << 4) | (r - rq->requests);
+}
+
+void IntelliKeysBase::request_send(request_t &r)
+{
+	r.sent = millis();
+	switch (r.type) {
+		case IK_REQUEST_VERSION:
+			get_version();
+			break;
+		case IK_REQUEST_CORRECT:
+			// A resync waiting for its reply completes the request
+			resync();
+			break;
+		case IK_REQUEST_SENSORS:
+			get_all_sensors();
+			break;
+		case IK_REQUEST_EEPROM:
+			// Read everything again unless a calibration write is
+			// using the read pipeline.
+			if (!sn || sn->cal_state == CAL_IDLE) {
+				memset(ee->eeprom_valid, 0, sizeof(ee->eeprom_valid));
+				ee->eeprom_count = 0;
+				ee->eeprom_all_valid = false;
+			}
+			break;
+	}
+}
+
+void IntelliKeysBase::request_finish(request_t &r, int status)
+{
+	r.status = status;
+	rq->requests_pending--;
+	if (r.done) r.done((r.seq << 4) | (&r - rq->requests), status);
+}
+
+void IntelliKeysBase::request_complete(uint8_t type)
+{
+	if (!rq || !rq->requests_pending) return;
+	for (int i = 0; i < IK_REQUEST_MAX; i++) {
+		request_t &r = rq->requests[i];
+		if (r.status == IK_REQUEST_PENDING && r.type == type) {
+			request_finish(r, IK_REQUEST_DONE);
 		}
 	}
+}
+
+void IntelliKeysBase::request_task(void)
+{
+	uint32_t now = millis();
 
-	if (!eeprom_all_valid) get_eeprom();
+	for (int i = 0; i < IK_REQUEST_MAX; i++) {
+		request_t &r = rq->requests[i];
+		if (r.status != IK_REQUEST_PENDING || now - r.sent < r.timeout) continue;
+		if (r.retries) {
+			debug_println("request retry, type=", r.type);
+			r.retries--;
+			request_send(r);
+		} else {
+			request_finish(r, IK_REQUEST_TIMEOUT);
+		}
+	}
+}
+
+void IntelliKeysBase::requests_cancel(void)
+{
+	for (int i = 0; i < IK_REQUEST_MAX; i++) {
+		if (rq->requests[i].status == IK_REQUEST_PENDING) {
+			request_finish(rq->requests[i], IK_REQUEST_CANCELLED);
+		}
+	}
+}
+
+IntelliKeysBase::request_t *IntelliKeysBase::request_lookup(ik_request_t handle)
+{
+	if (!rq || handle < 0 || (handle & 0xF) >= IK_REQUEST_MAX) return NULL;
+	request_t &r = rq->requests[handle & 0xF];
+	return (r.seq == (handle >> 4)) ? &r : NULL;
+}
+
+int IntelliKeysBase::requestStatus(ik_request_t handle)
+{
+	request_t *r = request_lookup(handle);
+	if (!r) return IK_REQUEST_NONE;
+	return r->status;
+}
+
+void IntelliKeysBase::requestCancel(ik_request_t handle)
+{
+	request_t *r = request_lookup(handle);
+	if (r && r->status == IK_REQUEST_PENDING) request_finish(*r, IK_REQUEST_CANCELLED);
 }
 
-void IntelliKeys::begin()
+void IntelliKeysBase::begin()
 {
+	// Cycle counter for getIrqStats()
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
 }
@@ -21,77 +21,464 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifndef _INTELLIKEYS_H_
+#define _INTELLIKEYS_H_
+
 #include "intellikeysdefs.h"
+#include "ik_bitmap.h"
+#include "ik_debounce.h"
+#include "ik_sensor.h"
+#include "ik_overlay.h"
+#include "ik_delegate.h"
 
 #define IK_EEPROM_SN_SIZE 29
 
-class IntelliKeys: public USBDriver {
+// Polled event mode. Poll every IK_POLL_MIN_US while the board is active,
+// doubling the interval on each empty poll up to IK_POLL_MAX_US.
+#ifndef IK_POLL_MIN_US
+#define IK_POLL_MIN_US 8000
+#endif
+#ifndef IK_POLL_MAX_US
+#define IK_POLL_MAX_US 256000
+#endif
+
+// Give up waiting for IK_EVENT_CORRECT_DONE after this long
+#ifndef IK_RESYNC_TIMEOUT_MS
+#define IK_RESYNC_TIMEOUT_MS 1000
+#endif
+
+// Keys that can auto-repeat at the same time
+#ifndef IK_REPEAT_MAX
+#define IK_REPEAT_MAX 8
+#endif
+
+// EEPROM reads in flight, and how long to wait for a reply before asking
+// again
+#ifndef IK_EEPROM_WINDOW
+#define IK_EEPROM_WINDOW 4
+#endif
+#ifndef IK_EEPROM_TIMEOUT_MS
+#define IK_EEPROM_TIMEOUT_MS 100
+#endif
+
+// Overlay ID must be stable this long before onOverlayChange
+#ifndef IK_OVERLAY_SETTLE_MS
+#define IK_OVERLAY_SETTLE_MS 300
+#endif
+
+// Sensor calibration: ALL_SENSORS passes averaged per reference card, time
+// between EEPROM byte writes, and write attempts per byte before giving up
+#ifndef IK_CAL_SAMPLES
+#define IK_CAL_SAMPLES 8
+#endif
+#ifndef IK_EEPROM_WRITE_MS
+#define IK_EEPROM_WRITE_MS 10
+#endif
+#ifndef IK_CAL_RETRIES
+#define IK_CAL_RETRIES 3
+#endif
+
+// EXPERIMENTAL. The EEPROM_WRITE report layout calibrationWrite() sends is
+// not documented and has not been confirmed on an IK. Until it is, the
+// write is left out unless this is set to 1.
+#ifndef IK_EXPERIMENTAL_EEPROM_WRITE
+#define IK_EXPERIMENTAL_EEPROM_WRITE 0
+#endif
+
+// Calibration steps for calibrateSensors() and onCalibration()
+enum {
+	IK_CAL_WHITE,
+	IK_CAL_BLACK,
+	IK_CAL_WRITE
+};
+
+// Pending table size (at most 16), default reply timeout and retries for
+// request()
+#ifndef IK_REQUEST_MAX
+#define IK_REQUEST_MAX 8
+#endif
+#ifndef IK_REQUEST_TIMEOUT_MS
+#define IK_REQUEST_TIMEOUT_MS 250
+#endif
+#ifndef IK_REQUEST_RETRIES
+#define IK_REQUEST_RETRIES 2
+#endif
+
+// Queries for request(), each completed by the matching reply
+enum {
+	IK_REQUEST_VERSION,	// IK_EVENT_VERSION
+	IK_REQUEST_CORRECT,	// IK_EVENT_CORRECT_DONE, after a resync
+	IK_REQUEST_SENSORS,	// IK_EVENT_ALL_SENSORS
+	IK_REQUEST_EEPROM	// last EEPROM byte read
+};
+
+// Request status
+enum {
+	IK_REQUEST_NONE,	// unknown handle, or its slot has been reused
+	IK_REQUEST_PENDING,
+	IK_REQUEST_DONE,
+	IK_REQUEST_TIMEOUT,
+	IK_REQUEST_CANCELLED
+};
+
+// Request handle, -1 if the request could not be made
+typedef int ik_request_t;
+
+// Marks a valid calibration cache entry in Teensy EEPROM
+#define IK_CAL_CACHE_MAGIC 0x1D
+
+// Boards remembered by the calibration cache
+#ifndef IK_CAL_CACHE_ENTRIES
+#define IK_CAL_CACHE_ENTRIES 4
+#endif
+
+// Received reports waiting for Task(). Must be a power of 2, at most 256
+// because the ring indexes are uint8_t.
+#ifndef IK_RX_RING_SIZE
+#define IK_RX_RING_SIZE 16
+#endif
+#if IK_RX_RING_SIZE < 2 || IK_RX_RING_SIZE > 256 || (IK_RX_RING_SIZE & (IK_RX_RING_SIZE - 1))
+#error "IK_RX_RING_SIZE must be a power of 2 from 2 to 256"
+#endif
+
+// Measurement build only. 1 makes Task() requeue receive transfers with
+// the USB host interrupt masked, the way the driver used to, and counts
+// each masked section in getIrqStats() so both hand-offs can be compared.
+#ifndef IK_IRQ_BASELINE
+#define IK_IRQ_BASELINE 0
+#endif
+
+// Events delivered per onEvents call at most
+#ifndef IK_EVENT_BATCH
+#define IK_EVENT_BATCH 32
+#endif
+
+// Decoded event for onEvents
+typedef struct {
+	uint32_t time;	// millis() when the report arrived
+	uint8_t type;	// IK_EVENT_MEMBRANE_PRESS, IK_EVENT_SWITCH, ...
+	uint8_t x;	// or switch or sensor number, or On/Off state
+	uint8_t y;	// or switch or sensor state
+} ik_event_t;
+
+// Time spent by this driver with USB host interrupts held off, in CPU
+// cycles. Divide by F_CPU/1000000 for microseconds.
+typedef struct {
+	uint32_t count;
+	uint32_t max_cycles;
+	uint32_t total_cycles;
+	uint32_t rx_overruns;	// reports dropped because the ring was full
+} ik_irq_stats_t;
+
+// Features for IntelliKeysT. The code and state of a feature left out are
+// not built into the sketch and the events it handles are ignored.
+#define IK_FEATURE_MEMBRANE	0x001	// membrane press, release and repeat
+#define IK_FEATURE_SWITCH	0x002	// switches and switch repeat
+#define IK_FEATURE_SENSORS	0x004	// overlay sensors, ID and calibration
+#define IK_FEATURE_EEPROM	0x008	// serial number and stored calibration
+#define IK_FEATURE_DEBOUNCE	0x010	// setDebounce()
+#define IK_FEATURE_REPEAT	0x020	// repeatStart() typematic repeat
+#define IK_FEATURE_EVENTS	0x040	// onEvents()
+#define IK_FEATURE_REQUESTS	0x080	// request()
+#define IK_FEATURE_FWLOAD	0x100	// load the IK firmware after power up
+#define IK_FEATURE_RESYNC	0x200	// resync(), get_correct() and onCorrect...
+#define IK_FEATURE_ALL		0x3FF
+
+// State for an optional feature, nothing if the feature is left out
+template <bool enabled, class T>
+struct IKOptional {
+	T value;
+	T *get(void) { return &value; }
+};
+template <class T>
+struct IKOptional<false, T> {
+	T *get(void) { return NULL; }
+};
+
+/*
+ * Driver mechanisms shared by every feature set. Use IntelliKeys, or
+ * IntelliKeysT<features> to leave features out.
+ */
+class IntelliKeysBase: public USBDriver {
 public:
-	IntelliKeys(USBHost &host) : /* txtimer(this),*/  updatetimer(this) { init(); }
+	IntelliKeysBase(USBHost &) : /* txtimer(this),*/  updatetimer(this), repeattimer(this) { init(); }
 	void begin();
 	// Commands
 	int setLED(uint8_t number, uint8_t value);
 	int sound(int freq, int duration, int volume);
 	int get_version(void);
 	int get_all_sensors(void);
+	// Ask for the current membrane and switch state. The whole reply goes
+	// to onCorrectMembrane, onCorrectSwitch and onCorrectDone once it is in.
+	// If more CORRECT commands are in flight only the last reply is passed.
 	int get_correct(void);
-	// Event callback functions
+	// Bring membrane and switch state back in line with the IK by sending
+	// only the press and release events needed. Runs automatically on
+	// connect, when the On/Off switch turns on and every interval_ms
+	// (0 = never, the default). The onCorrect... callbacks do not see the
+	// CORRECT reports a resync asks for.
+	void resync(void);
+	// Send a query and track its reply. Returns a handle, or -1 if all
+	// IK_REQUEST_MAX slots are pending or type is unknown. The command is
+	// sent again after timeout_ms, up to retries times. done(handle,
+	// status) is called once with IK_REQUEST_DONE, IK_REQUEST_TIMEOUT or
+	// IK_REQUEST_CANCELLED. One reply completes every pending request of
+	// its type.
+	ik_request_t request(uint8_t type,
+			const IKDelegate<ik_request_t, int> &done = IKDelegate<ik_request_t, int>(),
+			uint16_t timeout_ms = IK_REQUEST_TIMEOUT_MS,
+			uint8_t retries = IK_REQUEST_RETRIES);
+	// Status of a request. Finished requests keep their status until the
+	// slot is needed for a new request.
+	int requestStatus(ik_request_t handle);
+	void requestCancel(ik_request_t handle);
+	// Last firmware version reported, 0.0 if none yet
+	void getVersion(int *major, int *minor) {
+		*major = version_major;
+		*minor = version_minor;
+	}
+	void setResyncInterval(uint32_t interval_ms) { if (rs) rs->resync_interval = interval_ms; }
+	// Membrane debounce. A press is passed on once the cell has been held
+	// for press_ms, a release once it has stayed released for release_ms.
+	// 0,0 (the default) passes events straight through.
+	void setDebounce(uint16_t press_ms, uint16_t release_ms) {
+		if (debounce) debounce->setWindows(press_ms, release_ms);
+	}
+	void getDebounceStats(ik_debounce_stats_t *stats) {
+		if (debounce) *stats = debounce->stats;
+		else memset(stats, 0, sizeof(*stats));
+	}
+	// Overlay sensor hysteresis as a percent of the black/white span
+	// (default IK_SENSOR_HYSTERESIS). 0 gives the old single threshold.
+	void setSensorHysteresis(uint8_t percent) {
+		if (sn) sn->sensors.setHysteresis(percent);
+	}
+	// Sample the overlay sensors with the white or black reference card
+	// covering them (IK_CAL_WHITE or IK_CAL_BLACK). Returns false if busy.
+	bool calibrateSensors(uint8_t card);
+	// Write the sampled calibration to the IK EEPROM and read it back.
+	// Returns false if busy or both cards have not been sampled, and always
+	// unless IK_EXPERIMENTAL_EEPROM_WRITE is 1.
+	bool calibrationWrite(void);
+	// Called when a calibration step finishes
+	void onCalibration(void (*function)(int step, bool ok)) {
+		if (sn) sn->calibration_callback = function;
+	}
+	void onCalibration(const IKDelegate<int, bool> &delegate) {
+		if (sn) sn->calibration_callback = delegate;
+	}
+	// Overlay ID from the sensor bits (sensor n is bit n), or
+	// IK_OVERLAY_NONE until all sensors have reported.
+	int getOverlay(void) { return sn ? sn->overlay_id : IK_OVERLAY_NONE; }
+	void setOverlaySettle(uint16_t ms) { if (sn) sn->overlay_settle = ms; }
+	// IK_EVENT_MODE_AUTO (default) or IK_EVENT_MODE_POLLED. Call before the
+	// board connects.
+	void setEventMode(uint8_t mode) { event_mode = mode; }
+	uint8_t getEventMode(void) { return event_mode; }
+	// IK_FEATURE_* bits built into this driver
+	uint32_t getFeatures(void) { return feature_mask; }
+	// Milliseconds from connect until the EEPROM was read and onSerialNum
+	// called, 0 if not read yet.
+	uint32_t eepromReadTime(void) { return ee ? ee->eeprom_read_ms : 0; }
+	// True once the firmware version, membrane state, sensor calibration
+	// and sensor states have been read after connect.
+	bool ready(void) { return is_ready; }
+	// Milliseconds from connect to ready, 0 if not ready yet
+	uint32_t readyTime(void) { return ready_ms; }
+	// Cache the serial number and sensor calibration of up to
+	// IK_CAL_CACHE_ENTRIES boards in Teensy EEPROM at address
+	// (calibrationCacheSize() bytes). When a cached IK reconnects, its
+	// calibration is used as soon as the serial number is read. Boards may
+	// share one cache. -1 (default) disables the cache.
+	void setCalibrationCache(int address) { if (ee) ee->cal_cache_addr = address; }
+	static int calibrationCacheSize(void) { return IK_CAL_CACHE_ENTRIES * cal_cache_entry_size; }
+	void getIrqStats(ik_irq_stats_t *stats);
+	void clearIrqStats(void);
+	// Event callback functions. Each also takes an IKDelegate so one
+	// handler can serve several boards (see ik_delegate.h).
 	void onMembranePress(void (*function)(int x, int y)) {
 		membrane_press_callback = function;
 	}
+	void onMembranePress(const IKDelegate<int, int> &delegate) {
+		membrane_press_callback = delegate;
+	}
 	void onMembraneRelease(void (*function)(int x, int y)) {
 		membrane_release_callback = function;
 	}
+	void onMembraneRelease(const IKDelegate<int, int> &delegate) {
+		membrane_release_callback = delegate;
+	}
 	void onSwitch(void (*function)(int switch_number, int switch_state)) {
 		switch_callback = function;
 	}
+	void onSwitch(const IKDelegate<int, int> &delegate) {
+		switch_callback = delegate;
+	}
 	void onSensor(void (*function)(int sensor_number, int sensor_value)) {
-		sensor_callback = function;
+		if (sn) sn->sensor_callback = function;
 	}
+	void onSensor(const IKDelegate<int, int> &delegate) {
+		if (sn) sn->sensor_callback = delegate;
+	}
+	// Called once the overlay ID has been stable for the settle time
+	void onOverlayChange(void (*function)(int id)) {
+		if (sn) sn->overlay_callback = function;
+	}
+	void onOverlayChange(const IKDelegate<int> &delegate) {
+		if (sn) sn->overlay_callback = delegate;
+	}
+	void onReady(void (*function)(void)) {
+		ready_callback = function;
+	}
+	void onReady(const IKDelegate<> &delegate) {
+		ready_callback = delegate;
+	}
+	// Called once per connect, for the first version reply
 	void onVersion(void (*function)(int major, int minor)) {
 		version_callback = function;
 	}
+	void onVersion(const IKDelegate<int, int> &delegate) {
+		version_callback = delegate;
+	}
 	void onConnect(void (*function)(void)) {
 		connect_callback = function;
 	}
+	void onConnect(const IKDelegate<> &delegate) {
+		connect_callback = delegate;
+	}
 	void onDisconnect(void (*function)(void)) {
 		disconnect_callback = function;
 	}
+	void onDisconnect(const IKDelegate<> &delegate) {
+		disconnect_callback = delegate;
+	}
 	void onOnOffSwitch(void (*function)(int switch_status)) {
 		on_off_callback = function;
 	}
+	void onOnOffSwitch(const IKDelegate<int> &delegate) {
+		on_off_callback = delegate;
+	}
 	void onSerialNum(void (*function)(uint8_t serial[IK_EEPROM_SN_SIZE])) {
-		on_SN_callback = function;
+		if (ee) ee->on_SN_callback = function;
+	}
+	void onSerialNum(const IKDelegate<uint8_t *> &delegate) {
+		if (ee) ee->on_SN_callback = delegate;
 	}
 	void onCorrectMembrane(void (*function)(int x, int y)) {
-		correct_membrane_callback = function;
+		if (rs) rs->correct_membrane_callback = function;
+	}
+	void onCorrectMembrane(const IKDelegate<int, int> &delegate) {
+		if (rs) rs->correct_membrane_callback = delegate;
 	}
 	void onCorrectSwitch(void (*function)(int switch_number, int switch_state)) {
-		correct_switch_callback = function;
+		if (rs) rs->correct_switch_callback = function;
+	}
+	void onCorrectSwitch(const IKDelegate<int, int> &delegate) {
+		if (rs) rs->correct_switch_callback = delegate;
 	}
 	void onCorrectDone(void (*function)(void)) {
-		correct_done_callback = function;
+		if (rs) rs->correct_done_callback = function;
+	}
+	void onCorrectDone(const IKDelegate<> &delegate) {
+		if (rs) rs->correct_done_callback = delegate;
+	}
+	// All membrane press and release, switch, sensor, repeat and On/Off
+	// events from one Task() pass in one call, after the per-event
+	// callbacks. A pass with more than IK_EVENT_BATCH events makes more
+	// than one call.
+	void onEvents(void (*function)(const ik_event_t *events, size_t count)) {
+		if (eb) eb->events_callback = function;
+	}
+	void onEvents(const IKDelegate<const ik_event_t *, size_t> &delegate) {
+		if (eb) eb->events_callback = delegate;
+	}
+	// Current membrane contact state, one bit per cell. The bitmap is only
+	// written by Task(), one word at a time, so these are safe to call from
+	// loop() and from the fast path callbacks while events are arriving.
+	void membraneSnapshot(IKBitmap *snapshot) { *snapshot = membrane_state; }
+	bool membranePressed(int x, int y) {
+		return IKBitmap::valid(x, y) && membrane_state.test(x, y);
+	}
+	int membraneCount(void) { return membrane_state.count(); }
+	int membraneCount(int x, int y, int width, int height) {
+		return membrane_state.count(x, y, width, height);
+	}
+	// Switches the sketch has been told are on, switch n is bit n
+	uint16_t switchState(void) { return switches; }
+	// Cells pressed and released since snapshot previous was taken
+	int membraneDiff(const IKBitmap &previous, IKBitmap *pressed, IKBitmap *released) {
+		return IKBitmap::diff(previous, membrane_state, pressed, released);
 	}
+	// Repeat events generated by the IK firmware
+	void onMembraneRepeat(void (*function)(int x, int y)) {
+		membrane_repeat_callback = function;
+	}
+	void onMembraneRepeat(const IKDelegate<int, int> &delegate) {
+		membrane_repeat_callback = delegate;
+	}
+	void onSwitchRepeat(void (*function)(int switch_number)) {
+		switch_repeat_callback = function;
+	}
+	void onSwitchRepeat(const IKDelegate<int> &delegate) {
+		switch_repeat_callback = delegate;
+	}
+	// Typematic repeat. After repeatStart(id), onRepeat(id) is called after
+	// delay_ms then every rate_ms until repeatStop(id). id is any number the
+	// sketch chooses, such as a region or switch number. A timer keeps the
+	// rate steady, the callback runs from Task().
+	void setRepeat(uint16_t delay_ms, uint16_t rate_ms) {
+		if (!rp) return;
+		rp->repeat_delay = delay_ms;
+		rp->repeat_rate = rate_ms;
+	}
+	bool repeatStart(uint8_t id) {
+		return rp && repeatStart(id, rp->repeat_delay, rp->repeat_rate);
+	}
+	bool repeatStart(uint8_t id, uint16_t delay_ms, uint16_t rate_ms);
+	void repeatStop(uint8_t id);
+	void repeatStopAll(void);
+	void onRepeat(void (*function)(int id)) {
+		if (rp) rp->repeat_callback = function;
+	}
+	void onRepeat(const IKDelegate<int> &delegate) {
+		if (rp) rp->repeat_callback = delegate;
+	}
+	// Fast path callbacks. These run inside the USB host interrupt as soon as
+	// the report arrives, before the normal callbacks run from Task(). They
+	// must be short and must not block, print, call delay() or call any
+	// IntelliKeys function. state is 1 for press, 0 for release. They see
+	// the raw reports, before debounce and before resync corrections. A
+	// report dropped because the receive ring was full goes to neither
+	// path.
+	void onMembraneISR(void (*function)(int x, int y, int state)) {
+		membrane_isr_callback = function;
+	}
+	void onSwitchISR(void (*function)(int switch_number, int switch_state)) {
+		switch_isr_callback = function;
+	}
+
+	enum IK_LEDS {
+		IK_LED_SHIFT=1,
+		IK_LED_CAPS_LOCK=4,
+		IK_LED_MOUSE=7,
+		IK_LED_ALT=2,
+		IK_LED_CTRL_CMD=5,
+		IK_LED_NUM_LOCK=8
+	};
 
 protected:
-	virtual void Task();
-	virtual bool claim(Device_t *device, int type, const uint8_t *descriptors, uint32_t len);
-	virtual void disconnect();
-	virtual void timer_event(USBDriverTimer *whichTimer);
-	virtual void control(const Transfer_t *transfer);
-private:
-	void (*membrane_press_callback)(int x, int y);
-	void (*membrane_release_callback)(int x, int y);
-	void (*switch_callback)(int switch_number, int switch_state);
-	void (*sensor_callback)(int sensor_number, int sensor_value);
-	void (*version_callback)(int major, int minor);
-	void (*connect_callback)(void);
-	void (*disconnect_callback)(void);
-	void (*on_off_callback)(int switch_status);
-	void (*on_SN_callback)(uint8_t serial[IK_EEPROM_SN_SIZE]);
-	void (*correct_membrane_callback)(int x, int y);
-	void (*correct_switch_callback)(int switch_number, int switch_state);
-	void (*correct_done_callback)(void);
+	IKDelegate<int, int> membrane_press_callback;
+	IKDelegate<int, int> membrane_release_callback;
+	IKDelegate<int, int> switch_callback;
+	IKDelegate<int, int> version_callback;
+	IKDelegate<> ready_callback;
+	IKDelegate<> connect_callback;
+	IKDelegate<> disconnect_callback;
+	IKDelegate<int> on_off_callback;
+	IKDelegate<int, int> membrane_repeat_callback;
+	IKDelegate<int> switch_repeat_callback;
+	void (* volatile membrane_isr_callback)(int x, int y, int state);
+	void (* volatile switch_isr_callback)(int switch_number, int switch_state);
 	int PostCommand(uint8_t *command);
 	static void rx_callback1(const Transfer_t *transfer);
 	static void rx_callback3(const Transfer_t *transfer);
@@ -106,37 +493,68 @@ private:
 	void IK_firmware_load();
 	void ezusb_8051Reset(uint8_t resetBit);
 	int ezusb_DownloadIntelHex(bool internal);
-	void start();
-	void handleEvents(const uint8_t *rxpacket, size_t len);
+	enum {
+		CLAIM_NONE,
+		CLAIM_RUNNING,
+		CLAIM_FWLOAD
+	};
+	int claim_pipes(Device_t *device, int type, const uint8_t *descriptors, uint32_t len,
+			bool fwload);
+	void control_log(const Transfer_t *transfer);
+	void start_begin(void);
+	void start_end(void);
 	void clear_eeprom();
+	void clear_sensors();
+	void poll_event();
+	void poll_activity();
+	void irq_stats_update(uint32_t start_cycles);
+#if IK_IRQ_BASELINE
+	void rx_requeue_masked(void);
+#endif
+	void fast_path(const uint8_t *report);
+	void membrane_press(int x, int y);
+	void membrane_release(int x, int y);
+	void switch_update(int switch_number, int switch_state);
+	int send_correct(void);
+	void resync_apply(void);
+	void correct_done(void);
+	void debounce_task(void);
+	void repeat_timer(void);
+	void repeat_task(void);
 	void sensorUpdate(int sensor, int value);
-public:
-	enum IK_LEDS {
-		IK_LED_SHIFT=1,
-		IK_LED_CAPS_LOCK=4,
-		IK_LED_MOUSE=7,
-		IK_LED_ALT=2,
-		IK_LED_CTRL_CMD=5,
-		IK_LED_NUM_LOCK=8
-	};
+	void membrane_repeat(int x, int y);
+	void switch_repeat(int switch_number);
+	void eeprom_byte(uint8_t addr, uint8_t value);
+	void handle_common(const uint8_t *rxpacket);
 
-private:
 	Pipe_t mypipes[4] __attribute__ ((aligned(32)));
 	Transfer_t mytransfers[5] __attribute__ ((aligned(32)));
 	strbuf_t mystring_bufs[1];
 	//USBDriverTimer txtimer;
 	USBDriverTimer updatetimer;
+	USBDriverTimer repeattimer;
 	Pipe_t *rxpipe[3];
 	Pipe_t *txpipe;
-	bool first_update;
 	setup_t IK_setup;
 	uint8_t txbuffer[9*15];		// Must be multiple of 9!
 	uint8_t rxpacket[3][64];
 	volatile uint16_t txhead;
 	volatile uint16_t txtail;
 	volatile bool     txready;
-	volatile uint8_t  rxlen[3];
+	uint8_t rxring[IK_RX_RING_SIZE][IK_REPORT_LEN];
+	uint8_t rxring_len[IK_RX_RING_SIZE];
+	uint32_t rxring_time[IK_RX_RING_SIZE];
+	volatile uint8_t  rxring_head;
+	volatile uint8_t  rxring_tail;
+#if IK_IRQ_BASELINE
+	volatile uint8_t  rx_requeue;	// pipes Task() must requeue
+#endif
+	volatile ik_irq_stats_t irq_stats;
 	volatile bool     do_polling;
+	volatile uint32_t poll_interval;
+	bool     poll_again;
+	uint8_t  event_mode = IK_EVENT_MODE_AUTO;
+	uint32_t feature_mask = 0;
 	volatile uint8_t  IK_state;
 	const uint8_t mapEpAddr2Index[4] = {0, 0, 1, 2};
 	typedef struct
@@ -146,10 +564,362 @@ private:
 		uint8_t sensorWhite[IK_NUM_SENSORS];
 	} eeprom_t;
 	void get_eeprom(void);
-	eeprom_t eeprom_data;
-	bool eeprom_valid[sizeof(eeprom_t)];
-	bool eeprom_all_valid;
-	uint8_t sensorStatus[IK_NUM_SENSORS] = {255, 255, 255};
-	elapsedMillis eeprom_period;
+	// Calibration cache entry: magic, sequence number, eeprom_t
+	static const int cal_cache_entry_size = 2 + sizeof(eeprom_t);
+	static IntelliKeysBase *cal_cache_writer;
+	int cal_cache_find(const uint8_t *serial, eeprom_t *cached);
+	void cal_cache_load(void);
+	void cal_cache_store(void);
+	void cal_cache_task(void);
+	void cal_cache_abort(void);
+	elapsedMillis connect_time;
+	bool starting;
+	bool is_ready;
+	uint32_t ready_ms;
+	elapsedMillis startup_retry;
+	void startup_task(void);
+	uint32_t event_time;
+	void event_add(uint8_t type, uint8_t x, uint8_t y);
+	void events_flush(void);
+	enum {
+		CAL_IDLE,
+		CAL_SAMPLING,
+		CAL_WRITING,
+		CAL_VERIFYING
+	};
+	void cal_sample(int sensor, int value);
+	void cal_task(void);
+	void cal_verify(void);
+	void cal_done(int step, bool ok);
+	void sensor_calibrate(const uint8_t *black, const uint8_t *white);
+	void overlay_task(void);
 	bool version_done;
+	uint8_t version_major;
+	uint8_t version_minor;
+	typedef struct {
+		IKDelegate<ik_request_t, int> done;
+		uint32_t sent;
+		uint16_t seq;
+		uint16_t timeout;
+		uint8_t type;
+		uint8_t status;
+		uint8_t retries;
+	} request_t;
+	void request_send(request_t &r);
+	void request_finish(request_t &r, int status);
+	void request_complete(uint8_t type);
+	void request_task(void);
+	void requests_cancel(void);
+	request_t *request_lookup(ik_request_t handle);
+	IKBitmap membrane_state;
+	uint16_t switches;
+	typedef struct {
+		volatile bool active;
+		uint8_t id;
+		uint16_t rate;
+		uint32_t next;		// millis() of next repeat
+		volatile uint8_t fired;	// written by repeat_timer()
+		uint8_t delivered;	// written by repeat_task()
+	} repeat_t;
+
+	// Optional state. IntelliKeysT points these at its own storage for the
+	// features it has and leaves the rest NULL.
+	struct eeprom_state_t {
+		eeprom_t eeprom_data;
+		bool eeprom_valid[sizeof(eeprom_t)];
+		bool eeprom_all_valid;
+		uint8_t eeprom_count;
+		uint8_t eeprom_next;
+		uint8_t eeprom_outstanding;
+		uint32_t eeprom_read_ms;
+		elapsedMillis eeprom_period;
+		int cal_cache_addr = -1;
+		bool cal_cache_checked;
+		bool cal_cache_dirty;	// waiting for another board's write
+		int cal_cache_write;	// address of the entry being written
+		uint8_t cal_cache_pos;	// next byte of cal_cache_entry
+		uint8_t cal_cache_entry[cal_cache_entry_size];
+		bool SN_reported;
+		IKDelegate<uint8_t *> on_SN_callback;
+	};
+	struct sensor_state_t {
+		IKSensors sensors;
+		bool calibrated;
+		int8_t overlay_id = IK_OVERLAY_NONE;
+		int8_t overlay_raw = IK_OVERLAY_NONE;
+		elapsedMillis overlay_time;
+		uint16_t overlay_settle = IK_OVERLAY_SETTLE_MS;
+		uint8_t cal_state;
+		uint8_t cal_card;
+		uint8_t cal_passes;
+		uint8_t cal_seen;		// sensors sampled this pass, one bit each
+		uint16_t cal_sum[IK_NUM_SENSORS];
+		uint8_t cal_black[IK_NUM_SENSORS];
+		uint8_t cal_white[IK_NUM_SENSORS];
+		uint8_t cal_cards;		// cards sampled, one bit each
+		uint8_t cal_pending;		// calibration bytes left to write, one bit each
+		uint8_t cal_tries;
+		elapsedMillis cal_time;
+		IKDelegate<int, int> sensor_callback;
+		IKDelegate<int> overlay_callback;
+		IKDelegate<int, bool> calibration_callback;
+	};
+	struct repeat_state_t {
+		repeat_t repeats[IK_REPEAT_MAX];
+		uint16_t repeat_delay = 500;
+		uint16_t repeat_rate = 33;
+		IKDelegate<int> repeat_callback;
+	};
+	struct event_state_t {
+		ik_event_t events[IK_EVENT_BATCH];
+		uint8_t events_count;
+		IKDelegate<const ik_event_t *, size_t> events_callback;
+	};
+	struct request_state_t {
+		request_t requests[IK_REQUEST_MAX];
+		uint16_t request_seq;
+		uint8_t requests_pending;
+	};
+	struct resync_state_t {
+		IKBitmap correct_state;
+		uint16_t correct_switches;
+		uint16_t correct_seen;		// switches in the reply, one bit each
+		bool resync_active = false;
+		bool correct_report = false;	// get_correct() reply goes to onCorrect...
+		uint8_t correct_sent = 0;	// CORRECT commands not yet done
+		elapsedMillis correct_time;	// since the last CORRECT sent or reply
+		elapsedMillis resync_time;
+		uint32_t resync_interval = 0;
+		IKDelegate<int, int> correct_membrane_callback;
+		IKDelegate<int, int> correct_switch_callback;
+		IKDelegate<> correct_done_callback;
+	};
+	eeprom_state_t *ee = NULL;
+	sensor_state_t *sn = NULL;
+	IKDebounce *debounce = NULL;
+	repeat_state_t *rp = NULL;
+	event_state_t *eb = NULL;
+	request_state_t *rq = NULL;
+	resync_state_t *rs = NULL;
 };
+
+/*
+ * Driver with only the given IK_FEATURE_* bits built in, for example
+ *   IntelliKeysT<IK_FEATURE_MEMBRANE | IK_FEATURE_SWITCH | IK_FEATURE_FWLOAD> ikey1(myusb);
+ * Functions of a feature that was left out do nothing.
+ */
+template <uint32_t features>
+class IntelliKeysT: public IntelliKeysBase {
+public:
+	IntelliKeysT(USBHost &host) : IntelliKeysBase(host) {
+		feature_mask = features;
+		ee = eeprom_store.get();
+		sn = sensor_store.get();
+		debounce = debounce_store.get();
+		rp = repeat_store.get();
+		eb = event_store.get();
+		rq = request_store.get();
+		rs = resync_store.get();
+		if (rp) {
+			for (int i = 0; i < IK_REPEAT_MAX; i++) rp->repeats[i].active = false;
+		}
+	}
+
+protected:
+	virtual void Task();
+	virtual bool claim(Device_t *device, int type, const uint8_t *descriptors, uint32_t len);
+	virtual void disconnect();
+	virtual void timer_event(USBDriverTimer *whichTimer);
+	virtual void control(const Transfer_t *transfer);
+private:
+	void start();
+	void handleEvents(const uint8_t *rxpacket, size_t len);
+	IKOptional<(features & IK_FEATURE_EEPROM) != 0, eeprom_state_t> eeprom_store;
+	IKOptional<(features & IK_FEATURE_SENSORS) != 0, sensor_state_t> sensor_store;
+	IKOptional<(features & IK_FEATURE_DEBOUNCE) != 0, IKDebounce> debounce_store;
+	IKOptional<(features & IK_FEATURE_REPEAT) != 0, repeat_state_t> repeat_store;
+	IKOptional<(features & IK_FEATURE_EVENTS) != 0, event_state_t> event_store;
+	IKOptional<(features & IK_FEATURE_REQUESTS) != 0, request_state_t> request_store;
+	IKOptional<(features & IK_FEATURE_RESYNC) != 0, resync_state_t> resync_store;
+};
+
+template <uint32_t features>
+bool IntelliKeysT<features>::claim(Device_t *dev, int type, const uint8_t *descriptors, uint32_t len)
+{
+	uint32_t start_cycles = ARM_DWT_CYCCNT;
+	int claimed = claim_pipes(dev, type, descriptors, len, features & IK_FEATURE_FWLOAD);
+	if (claimed == CLAIM_RUNNING) start();
+	if (claimed != CLAIM_NONE) irq_stats_update(start_cycles);
+	return claimed != CLAIM_NONE;
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::start()
+{
+	if (features & IK_FEATURE_EVENTS) eb->events_count = 0;
+	if (features & IK_FEATURE_DEBOUNCE) debounce->reset();
+	if (features & IK_FEATURE_SENSORS) clear_sensors();
+	start_begin();
+	if (features & IK_FEATURE_EEPROM) {
+		clear_eeprom();
+		get_eeprom();
+	}
+	if (features & IK_FEATURE_SENSORS) get_all_sensors();
+	start_end();
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::disconnect()
+{
+	uint32_t start_cycles = ARM_DWT_CYCCNT;
+	updatetimer.stop();
+	if (features & IK_FEATURE_REPEAT) repeatStopAll();
+	membrane_state.clear();
+	switches = 0;
+	starting = false;
+	is_ready = false;
+	if (features & IK_FEATURE_REQUESTS) requests_cancel();
+	if (features & IK_FEATURE_EEPROM) cal_cache_abort();
+
+	if (disconnect_callback) disconnect_callback();
+	irq_stats_update(start_cycles);
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::timer_event(USBDriverTimer *whichTimer)
+{
+	if (whichTimer == &updatetimer) {
+		uint32_t start_cycles = ARM_DWT_CYCCNT;
+		if (event_mode == IK_EVENT_MODE_POLLED) {
+			updatetimer.start(poll_interval);
+			do_polling = true;
+		}
+		irq_stats_update(start_cycles);
+	} else if ((features & IK_FEATURE_REPEAT) && whichTimer == &repeattimer) {
+		uint32_t start_cycles = ARM_DWT_CYCCNT;
+		repeat_timer();
+		irq_stats_update(start_cycles);
+	}
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::control(const Transfer_t *transfer)
+{
+	uint32_t start_cycles = ARM_DWT_CYCCNT;
+	control_log(transfer);
+	if ((features & IK_FEATURE_FWLOAD) && IK_state != 1) IK_firmware_load();
+	irq_stats_update(start_cycles);
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::handleEvents(const uint8_t *rxpacket, size_t len)
+{
+	if ((rxpacket == NULL) || (len == 0)) return;
+
+	switch (*rxpacket) {
+		case IK_EVENT_MEMBRANE_PRESS:
+			if (!(features & IK_FEATURE_MEMBRANE)) break;
+			poll_activity();
+			if ((features & IK_FEATURE_DEBOUNCE) &&
+					IKBitmap::valid(rxpacket[1], rxpacket[2]) &&
+					!debounce->press(IKBitmap::cell(rxpacket[1], rxpacket[2]), millis())) {
+				break;
+			}
+			membrane_press(rxpacket[1], rxpacket[2]);
+			break;
+		case IK_EVENT_MEMBRANE_RELEASE:
+			if (!(features & IK_FEATURE_MEMBRANE)) break;
+			poll_activity();
+			if ((features & IK_FEATURE_DEBOUNCE) &&
+					IKBitmap::valid(rxpacket[1], rxpacket[2]) &&
+					!debounce->release(IKBitmap::cell(rxpacket[1], rxpacket[2]), millis())) {
+				break;
+			}
+			membrane_release(rxpacket[1], rxpacket[2]);
+			break;
+		case IK_EVENT_MEMBRANE_REPEAT:
+			if (!(features & IK_FEATURE_MEMBRANE)) break;
+			poll_activity();
+			membrane_repeat(rxpacket[1], rxpacket[2]);
+			break;
+		case IK_EVENT_SWITCH:
+			if (!(features & IK_FEATURE_SWITCH)) break;
+			poll_activity();
+			switch_update(rxpacket[1], rxpacket[2]);
+			break;
+		case IK_EVENT_SWITCH_REPEAT:
+			if (!(features & IK_FEATURE_SWITCH)) break;
+			poll_activity();
+			switch_repeat(rxpacket[1]);
+			break;
+		case IK_EVENT_SENSOR_CHANGE:
+			if (!(features & IK_FEATURE_SENSORS)) break;
+			poll_activity();
+			sensorUpdate(rxpacket[1], rxpacket[2]);
+			break;
+		case IK_EVENT_EEPROM_READBYTE:
+			if (features & IK_FEATURE_EEPROM) eeprom_byte(rxpacket[2], rxpacket[1]);
+			break;
+		default:
+			handle_common(rxpacket);
+			break;
+	}
+}
+
+template <uint32_t features>
+void IntelliKeysT<features>::Task()
+{
+	if ((features & IK_FEATURE_FWLOAD) && IK_state == 2) IK_firmware_load();
+
+	uint32_t tail = rxring_tail;
+	while (tail != rxring_head) {
+		// Read the slot only after seeing the new head
+		__asm__ volatile("" ::: "memory");
+		event_time = rxring_time[tail];
+		handleEvents(rxring[tail], rxring_len[tail]);
+		tail = (tail + 1) & (IK_RX_RING_SIZE - 1);
+		rxring_tail = tail;
+	}
+#if IK_IRQ_BASELINE
+	if (rx_requeue) rx_requeue_masked();
+#endif
+	event_time = millis();
+
+	if ((features & IK_FEATURE_DEBOUNCE) && debounce->enabled()) debounce_task();
+
+	if (features & IK_FEATURE_REPEAT) repeat_task();
+	if (features & IK_FEATURE_SENSORS) overlay_task();
+
+	if ((features & IK_FEATURE_EVENTS) && eb->events_count) events_flush();
+
+	if (event_mode == IK_EVENT_MODE_POLLED && (do_polling || poll_again)) {
+		do_polling = false;
+		poll_again = false;
+		poll_event();
+	}
+
+	if ((features & IK_FEATURE_EEPROM) && !ee->eeprom_all_valid) get_eeprom();
+	if ((features & IK_FEATURE_EEPROM) &&
+			(ee->cal_cache_dirty || cal_cache_writer == this)) {
+		cal_cache_task();
+	}
+
+	if (starting) startup_task();
+
+	if ((features & IK_FEATURE_SENSORS) && sn->cal_state != CAL_IDLE) cal_task();
+
+	if ((features & IK_FEATURE_REQUESTS) && rq->requests_pending) request_task();
+
+	if ((features & IK_FEATURE_RESYNC) && rs->resync_interval &&
+			rs->resync_time >= rs->resync_interval) {
+		resync();
+	}
+}
+
+// Every feature, the driver as it has always been
+class IntelliKeys: public IntelliKeysT<IK_FEATURE_ALL> {
+public:
+	IntelliKeys(USBHost &host) : IntelliKeysT<IK_FEATURE_ALL>(host) { }
+};
+
+#endif